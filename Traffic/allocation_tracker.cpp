@@ -0,0 +1,141 @@
+#include "allocation_tracker.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace {
+	// Constant-initialized, so touching it from operator new cannot itself allocate.
+	struct ThreadState {
+		bool isTracking = false;
+		AllocationTracker::Phase phase = AllocationTracker::Other;
+		AllocationTracker::Counts counts[AllocationTracker::PHASE_COUNT];
+	};
+
+	thread_local ThreadState state;
+
+	const char* PHASE_NAMES[AllocationTracker::PHASE_COUNT] = {
+		"other", "signals", "arrivals", "queues", "lane-changes", "movement", "demand", "departures", "intersections", "bookkeeping"
+	};
+
+	void* allocate(size_t size) {
+		AllocationTracker::record(size);
+		while (true) {
+			if (void* memory = std::malloc(size == 0 ? 1 : size); memory != nullptr) {
+				return memory;
+			}
+			std::new_handler handler = std::get_new_handler();
+			if (handler == nullptr) {
+				throw std::bad_alloc();
+			}
+			handler();
+		}
+	}
+
+	void* allocateAligned(size_t size, size_t alignment) {
+		AllocationTracker::record(size);
+		while (true) {
+#ifdef _WIN32
+			void* memory = _aligned_malloc(size == 0 ? 1 : size, alignment);
+#else
+			void* memory = nullptr;
+			if (posix_memalign(&memory, alignment, size == 0 ? 1 : size) != 0) {
+				memory = nullptr;
+			}
+#endif
+			if (memory != nullptr) {
+				return memory;
+			}
+			std::new_handler handler = std::get_new_handler();
+			if (handler == nullptr) {
+				throw std::bad_alloc();
+			}
+			handler();
+		}
+	}
+
+	void freeAligned(void* memory) {
+#ifdef _WIN32
+		_aligned_free(memory);
+#else
+		std::free(memory);
+#endif
+	}
+}
+
+AllocationTracker::Scope::Scope(Phase phase) : _previous(state.phase) {
+	state.phase = phase;
+}
+
+AllocationTracker::Scope::~Scope() {
+	state.phase = _previous;
+}
+
+void AllocationTracker::start() {
+	state.isTracking = true;
+}
+
+void AllocationTracker::stop() {
+	state.isTracking = false;
+}
+
+bool AllocationTracker::isTracking() {
+	return state.isTracking;
+}
+
+void AllocationTracker::reset() {
+	for (Counts& counts : state.counts) {
+		counts = {};
+	}
+}
+
+AllocationTracker::Counts AllocationTracker::getCounts(Phase phase) {
+	return state.counts[phase];
+}
+
+AllocationTracker::Counts AllocationTracker::getTotal() {
+	Counts total;
+	for (const Counts& counts : state.counts) {
+		total.allocations += counts.allocations;
+		total.bytes += counts.bytes;
+	}
+	return total;
+}
+
+const char* AllocationTracker::getPhaseName(Phase phase) {
+	return phase < PHASE_COUNT ? PHASE_NAMES[phase] : "?";
+}
+
+void AllocationTracker::record(size_t bytes) {
+	if (state.isTracking) {
+		Counts& counts = state.counts[state.phase];
+		counts.allocations++;
+		counts.bytes += bytes;
+	}
+}
+
+// Replacement global allocation functions. The array and nothrow forms call these by default.
+void* operator new(size_t size) {
+	return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	return allocateAligned(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+	freeAligned(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+	freeAligned(memory);
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Opt-in count of heap allocations, attributed to the phase of the tick that made them.
+//
+// The global operator new and delete are replaced (see allocation_tracker.cpp) with versions that, on a thread that has
+// called start(), add each allocation to the counters of that thread's current phase. Other threads, and every thread
+// before start(), pay only for a thread_local flag check. Simulation::tick() marks its phases with Scope, so a report
+// can say which part of the tick allocated.
+class AllocationTracker {
+public:
+	enum Phase : uint8_t {
+		Other,
+		Signals,
+		Arrivals,
+		Queues,
+		LaneChanges,
+		Movement,
+		Demand,
+		Departures,
+		Intersections,
+		Bookkeeping,
+		PHASE_COUNT
+	};
+
+	struct Counts {
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+	};
+
+	// Sets the calling thread's phase until the end of the enclosing block.
+	class Scope {
+	private:
+		Phase _previous;
+	public:
+		explicit Scope(Phase phase);
+		~Scope();
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+	// Start or stop counting allocations made by the calling thread. Counts are kept per thread and are not cleared.
+	static void start();
+	static void stop();
+	static bool isTracking();
+	static void reset();
+
+	static Counts getCounts(Phase phase);
+	static Counts getTotal();
+	static const char* getPhaseName(Phase phase);
+
+	// Called by the replacement operator new.
+	static void record(size_t bytes);
+};
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "demand.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+	// Splits off the next whitespace-separated field, or returns an empty view at the end of the line.
+	std::string_view nextField(std::string_view& line) {
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == std::string_view::npos) {
+			line = {};
+			return {};
+		}
+		size_t end = line.find_first_of(" \t\r", start);
+		std::string_view field = line.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+		line.remove_prefix(end == std::string_view::npos ? line.size() : end);
+		return field;
+	}
+
+	template <typename T>
+	bool parseField(std::string_view& line, T& value) {
+		std::string_view field = nextField(line);
+		auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+		return !field.empty() && error == std::errc() && end == field.data() + field.size();
+	}
+}
+
+DemandStream::DemandStream(uint64_t lookaheadTicks) : _lookaheadTicks(lookaheadTicks) {}
+
+bool DemandStream::open(const std::string& path) {
+	auto file = std::make_unique<std::ifstream>(path, std::ifstream::binary);
+	if (!file->is_open()) {
+		return false;
+	}
+	open(std::move(file));
+	return true;
+}
+
+void DemandStream::open(std::unique_ptr<std::istream> in) {
+	_in = std::move(in);
+	_buffer.resize(CHUNK_BYTES);
+	_lineStart = 0;
+	_bufferEnd = 0;
+	_isInputDone = false;
+	_lineNumber = 0;
+	_lastStart = 0;
+	_pending = {};
+}
+
+bool DemandStream::nextLine(std::string_view& line) {
+	while (true) {
+		auto begin = _buffer.begin() + _lineStart;
+		auto end = _buffer.begin() + _bufferEnd;
+		auto newline = std::find(begin, end, '\n');
+		if (newline != end) {
+			line = std::string_view(&*begin, newline - begin);
+			_lineStart = newline - _buffer.begin() + 1;
+			_lineNumber++;
+			return true;
+		}
+
+		if (_in == nullptr) {
+			// The last line need not end in a newline.
+			if (_lineStart == _bufferEnd) {
+				return false;
+			}
+			line = std::string_view(_buffer.data() + _lineStart, _bufferEnd - _lineStart);
+			_lineStart = _bufferEnd;
+			_lineNumber++;
+			return true;
+		}
+
+		// Keep the partial line and read the next chunk after it, growing the buffer only for a line longer than a chunk.
+		size_t partial = _bufferEnd - _lineStart;
+		std::copy(_buffer.begin() + _lineStart, _buffer.begin() + _bufferEnd, _buffer.begin());
+		_lineStart = 0;
+		_bufferEnd = partial;
+		if (_bufferEnd == _buffer.size()) {
+			_buffer.resize(_buffer.size() * 2);
+		}
+
+		_in->read(_buffer.data() + _bufferEnd, static_cast<std::streamsize>(_buffer.size() - _bufferEnd));
+		_bufferEnd += static_cast<size_t>(_in->gcount());
+		if (!*_in) {
+			_in.reset();
+		}
+	}
+}
+
+void DemandStream::parseLine(std::string_view line) {
+	auto fail = [this](const std::string& message) {
+		throw std::runtime_error("Demand line " + std::to_string(_lineNumber) + ": " + message);
+	};
+
+	line = line.substr(0, line.find('#'));
+	std::string_view keyword = nextField(line);
+	if (keyword.empty()) {
+		return;
+	}
+
+	Pending pending {};
+	if (keyword == "trip") {
+		if (!parseField(line, pending.start) || !parseField(line, pending.origin) || !parseField(line, pending.destination)) {
+			fail("expected: trip <tick> <origin node> <terminal node>");
+		}
+		pending.end = pending.start;
+		pending.count = 1;
+	}
+	else if (keyword == "od") {
+		if (!parseField(line, pending.start) || !parseField(line, pending.end) || !parseField(line, pending.origin)
+			|| !parseField(line, pending.destination) || !parseField(line, pending.count)) {
+			fail("expected: od <start tick> <end tick> <origin node> <terminal node> <trip count>");
+		}
+		if (pending.end <= pending.start) {
+			fail("OD slice must end after it starts");
+		}
+		if (pending.count == 0) {
+			return;
+		}
+	}
+	else {
+		fail("unknown keyword '" + std::string(keyword) + "'");
+	}
+
+	if (pending.start < _lastStart) {
+		fail("lines must be in order of their first tick");
+	}
+	_lastStart = pending.start;
+	pending.tick = pending.start;
+	_pending.push(pending);
+}
+
+void DemandStream::readUntil(uint64_t tick) {
+	std::string_view line;
+	while (!_isInputDone && _lastStart <= tick) {
+		if (!nextLine(line)) {
+			_isInputDone = true;
+			_buffer.clear();
+			_buffer.shrink_to_fit();
+			break;
+		}
+		parseLine(line);
+	}
+}
+
+void DemandStream::takeDue(uint64_t tick, std::vector<Trip>& due) {
+	readUntil(tick + _lookaheadTicks);
+
+	while (!_pending.empty() && _pending.top().tick <= tick) {
+		Pending next = _pending.top();
+		_pending.pop();
+		due.push_back({ next.tick, next.origin, next.destination });
+
+		// An OD slice goes back in the queue for its next trip.
+		if (++next.index < next.count) {
+			next.tick = next.start + (next.end - next.start) * next.index / next.count;
+			_pending.push(next);
+		}
+	}
+}
\ No newline at end of file
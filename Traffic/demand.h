@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Time-varying demand read incrementally from a file of trips and origin-destination matrix slices.
+//
+// A full day of demand for a large network does not fit in memory, so the file is read in fixed-size chunks and only
+// as far ahead as the lookahead window past the current tick. Parsed trips wait in a queue ordered by departure tick;
+// an OD slice stays a single queue entry that yields its trips one at a time, spread evenly over its interval. Memory
+// use therefore depends on the demand inside the window, not on the size of the file, and a run starts immediately.
+//
+// Lines must be in order of their first tick; '#' starts a comment. Node ids are Scenario node ids.
+//
+//   trip <tick> <origin node> <terminal node>
+//   od <start tick> <end tick> <origin node> <terminal node> <trip count>
+class DemandStream {
+public:
+	static constexpr size_t CHUNK_BYTES = 1 << 20;
+	static constexpr uint64_t DEFAULT_LOOKAHEAD_TICKS = 240;
+
+	struct Trip {
+		uint64_t tick;
+		int origin;
+		int destination;
+	};
+private:
+	struct Pending {
+		uint64_t tick;
+		uint64_t start;
+		uint64_t end;
+		uint32_t count;
+		uint32_t index;
+		int origin;
+		int destination;
+		bool operator>(const Pending& other) const { return tick > other.tick; }
+	};
+
+	std::unique_ptr<std::istream> _in;
+	std::vector<char> _buffer;
+	size_t _lineStart = 0;
+	size_t _bufferEnd = 0;
+	bool _isInputDone = true;
+	int _lineNumber = 0;
+	// First tick of the last line read, so the reader knows how far ahead it is.
+	uint64_t _lastStart = 0;
+	uint64_t _lookaheadTicks;
+	std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> _pending;
+
+	bool nextLine(std::string_view& line);
+	void parseLine(std::string_view line);
+	void readUntil(uint64_t tick);
+public:
+	explicit DemandStream(uint64_t lookaheadTicks = DEFAULT_LOOKAHEAD_TICKS);
+
+	bool open(const std::string& path);
+	void open(std::unique_ptr<std::istream> in);
+
+	// Appends every trip departing at or before `tick` to `due`, in departure order. Throws std::runtime_error
+	// describing the offending line if the file is malformed.
+	void takeDue(uint64_t tick, std::vector<Trip>& due);
+	bool isFinished() const { return _isInputDone && _pending.empty(); }
+	// Queue entries held in memory: individual trips plus OD slices still yielding trips.
+	size_t getPendingCount() const { return _pending.size(); }
+};
\ No newline at end of file
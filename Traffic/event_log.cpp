@@ -0,0 +1,204 @@
+#include "event_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+std::atomic<uint64_t> EventLog::_nextInstance = 1;
+
+EventLog::EventLog() : _instance(_nextInstance++) {}
+
+EventLog::~EventLog() {
+	close();
+}
+
+bool EventLog::open(const std::string& path) {
+	close();
+
+	_file.open(path, std::ofstream::binary | std::ofstream::trunc);
+	if (!_file.is_open()) {
+		return false;
+	}
+
+	Header header { MAGIC, VERSION, sizeof(EventRecord), 0 };
+	_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	_written = 0;
+	_isStopping = false;
+	_writer = std::thread(&EventLog::runWriter, this);
+	_isOpen.store(true, std::memory_order_release);
+	return true;
+}
+
+void EventLog::close() {
+	if (!_writer.joinable()) {
+		return;
+	}
+
+	_isOpen.store(false, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(_writerMutex);
+		_isStopping = true;
+	}
+	_wake.notify_one();
+	_writer.join();
+
+	// Anything logged between the writer's last pass and the flag going down.
+	drain();
+	_file.close();
+}
+
+EventLog::Ring& EventLog::ringForThisThread() {
+	struct CachedRing {
+		uint64_t instance;
+		Ring* ring;
+	};
+	thread_local CachedRing cached { 0, nullptr };
+
+	if (cached.instance == _instance) {
+		return *cached.ring;
+	}
+
+	std::lock_guard<std::mutex> lock(_ringsMutex);
+	std::thread::id self = std::this_thread::get_id();
+	Ring* ring = nullptr;
+	for (const std::unique_ptr<Ring>& existing : _rings) {
+		if (existing->owner == self) {
+			ring = existing.get();
+		}
+	}
+
+	if (ring == nullptr) {
+		_rings.push_back(std::make_unique<Ring>());
+		ring = _rings.back().get();
+		ring->owner = self;
+		ring->index = static_cast<uint16_t>(_rings.size() - 1);
+	}
+
+	cached = { _instance, ring };
+	return *ring;
+}
+
+void EventLog::log(EventRecord::Type type, uint64_t tick, uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e) {
+	if (!isOpen()) {
+		return;
+	}
+
+	Ring& ring = ringForThisThread();
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.tail.load(std::memory_order_acquire) >= RING_CAPACITY) {
+		ring.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	ring.records[head & (RING_CAPACITY - 1)] = { tick, type, ring.index, { a, b, c, d, e } };
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+void EventLog::drain() {
+	std::vector<Ring*> rings;
+	{
+		std::lock_guard<std::mutex> lock(_ringsMutex);
+		for (const std::unique_ptr<Ring>& ring : _rings) {
+			rings.push_back(ring.get());
+		}
+	}
+
+	for (Ring* ring : rings) {
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+
+		// At most two contiguous runs, either side of the wrap.
+		while (tail != head) {
+			size_t start = tail & (RING_CAPACITY - 1);
+			size_t count = static_cast<size_t>(std::min<uint64_t>(head - tail, RING_CAPACITY - start));
+			_file.write(reinterpret_cast<const char*>(&ring->records[start]), count * sizeof(EventRecord));
+			tail += count;
+			_written += count;
+		}
+
+		ring->tail.store(tail, std::memory_order_release);
+	}
+
+	_file.flush();
+}
+
+void EventLog::runWriter() {
+	static constexpr std::chrono::milliseconds DRAIN_INTERVAL_MS(20);
+
+	std::unique_lock<std::mutex> lock(_writerMutex);
+	while (!_isStopping) {
+		_wake.wait_for(lock, DRAIN_INTERVAL_MS, [this]() { return _isStopping; });
+		drain();
+	}
+}
+
+uint64_t EventLog::getDroppedCount() {
+	std::lock_guard<std::mutex> lock(_ringsMutex);
+	uint64_t dropped = 0;
+	for (const std::unique_ptr<Ring>& ring : _rings) {
+		dropped += ring->dropped.load(std::memory_order_relaxed);
+	}
+	return dropped;
+}
+
+int64_t EventLog::decode(std::istream& in, std::ostream& out) {
+	static const char* COLORS[] = { "red", "yellow", "green" };
+
+	Header header {};
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != MAGIC || header.version != VERSION
+		|| header.recordSize != sizeof(EventRecord)) {
+		return -1;
+	}
+
+	int64_t count = 0;
+	EventRecord record {};
+	while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+		const uint32_t* args = record.args;
+		out << "tick " << record.tick << " thread " << record.thread << " ";
+
+		switch (record.type) {
+		case EventRecord::Collision:
+			out << "collision lane " << args[0] << " position " << args[1] << " car " << args[2];
+			break;
+		case EventRecord::LaneExit:
+			out << "lane-exit lane " << args[0] << " destination " << static_cast<int32_t>(args[1]);
+			break;
+		case EventRecord::SignalChange:
+			out << "signal lane " << args[0] << " " << (args[1] < 3 ? COLORS[args[1]] : "?") << " for " << args[2] << " ticks";
+			break;
+		case EventRecord::CarCreated:
+			out << "car-created lane " << args[0] << " destination " << static_cast<int32_t>(args[1]);
+			break;
+		case EventRecord::TripCompleted:
+			out << "trip-completed travel " << args[0] << " stops " << args[1];
+			break;
+		case EventRecord::BadNotification:
+			out << "bad-notification " << (args[0] == 0 ? "delete_car" : "create_car");
+			break;
+		case EventRecord::LaneChange:
+			out << "lane-change from " << args[0] << " to " << args[1] << " position " << args[2];
+			break;
+		case EventRecord::BadTrip:
+			out << "bad-trip origin " << static_cast<int32_t>(args[0]) << " destination " << static_cast<int32_t>(args[1]);
+			break;
+		default:
+			out << "unknown type " << record.type;
+			break;
+		}
+
+		out << "\n";
+		count++;
+	}
+
+	return count;
+}
\ No newline at end of file
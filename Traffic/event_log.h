@@ -0,0 +1,108 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fixed-size binary record. The meaning of the arguments depends on the type; see EventLog::decode().
+struct EventRecord {
+	enum Type : uint16_t {
+		Collision,          // lane, position, index of the car on the lane counting from the front
+		LaneExit,           // lane, destination
+		SignalChange,       // lane, color, phase duration
+		CarCreated,         // lane, destination
+		TripCompleted,      // travel ticks, stops
+		BadNotification,    // message (0 delete car, 1 create car)
+		LaneChange,         // from lane, to lane, position
+		BadTrip,            // origin node, destination node
+		TYPE_COUNT
+	};
+
+	uint64_t tick;
+	uint16_t type;
+	// Index of the ring, and so the thread, the record was logged from.
+	uint16_t thread;
+	uint32_t args[5];
+};
+
+static_assert(sizeof(EventRecord) == 32, "Event records are written to disk as-is");
+
+// Structured event log that never blocks the thread logging to it.
+//
+// Each logging thread owns a single-producer, single-consumer ring of records, found through a thread_local cache, so
+// log() is a handful of stores and one release; nothing is formatted and no lock is taken. A background writer thread
+// drains every ring to the file in batches. If a ring fills faster than it is drained, records are dropped and counted
+// rather than making the producer wait.
+//
+// The file is a header followed by raw EventRecords; `Traffic decode <file>` turns it into text.
+class EventLog {
+public:
+	static constexpr uint32_t MAGIC = 0x474C5645; // "EVLG"
+	static constexpr uint32_t VERSION = 1;
+	// Records per thread. A power of two, so ring positions wrap with a mask.
+	static constexpr size_t RING_CAPACITY = 4096;
+private:
+	struct Ring {
+		std::array<EventRecord, RING_CAPACITY> records;
+		std::thread::id owner;
+		uint16_t index;
+		alignas(64) std::atomic<uint64_t> head = 0;
+		alignas(64) std::atomic<uint64_t> tail = 0;
+		std::atomic<uint64_t> dropped = 0;
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t recordSize;
+		uint32_t reserved;
+	};
+
+	// Distinguishes logs in the thread_local cache, even if one is created at the address of another.
+	static std::atomic<uint64_t> _nextInstance;
+	uint64_t _instance;
+
+	// Only taken when a thread logs for the first time, and by the writer to list the rings.
+	std::mutex _ringsMutex;
+	std::vector<std::unique_ptr<Ring>> _rings;
+
+	std::ofstream _file;
+	std::atomic<bool> _isOpen = false;
+	std::thread _writer;
+	std::mutex _writerMutex;
+	std::condition_variable _wake;
+	bool _isStopping = false;
+	uint64_t _written = 0;
+
+	Ring& ringForThisThread();
+	void drain();
+	void runWriter();
+public:
+	EventLog();
+	EventLog(const EventLog&) = delete;
+	EventLog& operator=(const EventLog&) = delete;
+	~EventLog();
+
+	// Truncates the file and starts the writer thread.
+	bool open(const std::string& path);
+	// Writes everything still buffered and stops the writer thread.
+	void close();
+	bool isOpen() const { return _isOpen.load(std::memory_order_relaxed); }
+
+	// Safe to call from any thread; does nothing while the log is closed.
+	void log(EventRecord::Type type, uint64_t tick, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint32_t d = 0, uint32_t e = 0);
+	// Both complete once close() has returned.
+	uint64_t getWrittenCount() const { return _written; }
+	uint64_t getDroppedCount();
+
+	// Writes one line of text per record. Returns the number of records, or -1 if the input is not an event log.
+	static int64_t decode(std::istream& in, std::ostream& out);
+};
\ No newline at end of file
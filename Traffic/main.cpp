@@ -1,23 +1,311 @@
-﻿#include "screenwriter.h"
+﻿#include "allocation_tracker.h"
+#include "demand.h"
+#include "event_log.h"
+#include "metrics.h"
+#include "scenario.h"
+#include "scenario_generator.h"
+#include "scheduler.h"
+#include "screenwriter.h"
 #include "simulation.h"
 
+#include <charconv>
+#include <chrono>
 #include <conio.h>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
 
 #ifdef RUN_TESTS
 #include "gtest/gtest.h"
 #else
-int main()
+// Companion reader for the shared-memory metrics segment. It only maps the segment read-only, so it can poll as often
+// as it likes without affecting the simulation.
+int runMetricsReader()
 {
-	ScreenWriter::init();
+	MetricsSharedMemory metrics;
+	if (!metrics.open()) {
+		std::cerr << "No running simulation found (shared-memory segment '" << MetricsSharedMemory::DEFAULT_NAME << "' is missing)" << std::endl;
+		return 1;
+	}
+
+	static const char* SIGNAL_NAMES[] = { "Red", "Yellow", "Green" };
+	MetricsSnapshot snapshot;
 	ScreenWriter::clearScreen();
-	Simulation simulation;
-	simulation.start();
-	
-	bool isRunning = true;
-	while (isRunning) {
+
+	Scheduler scheduler;
+	scheduler.onInput([&scheduler]() {
 		if (_kbhit()) {
-			isRunning = false;
+			_getch();
+			scheduler.stop();
+		}
+		});
+	scheduler.every(std::chrono::milliseconds(100), [&metrics, &snapshot]() {
+		if (metrics.read(snapshot)) {
+			std::cout << "\033[1;1H"
+				<< "tick " << snapshot.tick << "   ticks/sec " << snapshot.ticksPerSecond << "   cars " << snapshot.carCount << "      \n";
+			// The segment only has room for the first lanes of a large network.
+			if (snapshot.totalLaneCount > snapshot.laneCount) {
+				std::cout << "showing lanes 0-" << snapshot.laneCount - 1 << " of " << snapshot.totalLaneCount << "      ";
+			}
+			std::cout << "\n"
+				<< "lane  cars  signal  phase\n";
+			for (uint32_t i = 0; i < snapshot.laneCount; i++) {
+				std::cout << i << "\t" << snapshot.laneOccupancy[i] << "\t";
+				if (snapshot.signalState[i] < 3) {
+					std::cout << SIGNAL_NAMES[snapshot.signalState[i]] << "\t" << snapshot.phaseElapsed[i] << "/" << snapshot.phaseDuration[i];
+				}
+				else {
+					std::cout << "-\t-";
+				}
+				std::cout << "        \n";
+			}
+			std::cout << std::flush;
+		}
+		});
+	scheduler.run();
+
+	return 0;
+}
+
+// Traffic decode <event log>: prints the binary records written to events.bin as text.
+int runDecoder(int argc, char* argv[])
+{
+	if (argc < 3) {
+		std::cerr << "Usage: Traffic decode <event log>" << std::endl;
+		return 1;
+	}
+
+	std::ifstream in(argv[2], std::ifstream::binary);
+	if (!in.is_open()) {
+		std::cerr << "Failed to open " << argv[2] << std::endl;
+		return 1;
+	}
+
+	if (EventLog::decode(in, std::cout) < 0) {
+		std::cerr << argv[2] << " is not an event log" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+// Parses all of `text` as a number, so that a typo is reported instead of being read as 0 the way atoi() reads it.
+template <typename T>
+bool parseNumber(const char* text, T& value)
+{
+	const char* end = text + std::strlen(text);
+	auto [last, error] = std::from_chars(text, end, value);
+	return error == std::errc() && last == end && last != text;
+}
+
+// Traffic generate grid|planar <rows> <columns> [--length n] [--lanes n] [--green n] [--yellow n] [--all-red n] [--demand percent]
+//     [--buses percent] [--trucks percent] [--control gap|queue] [--max-green n] [--drop fraction] [--seed n] [--mesoscopic] <output file>
+int runGenerator(int argc, char* argv[])
+{
+	if (argc < 6) {
+		std::cerr << "Usage: Traffic generate grid|planar <rows> <columns> [options] <output file>" << std::endl;
+		return 1;
+	}
+
+	ScenarioGenerator::Options options;
+	options.isPlanar = std::string(argv[2]) == "planar";
+	if (!parseNumber(argv[3], options.rows) || !parseNumber(argv[4], options.columns)) {
+		std::cerr << "Rows and columns must be whole numbers" << std::endl;
+		return 1;
+	}
+
+	for (int i = 5; i < argc - 1; i++) {
+		std::string option = argv[i];
+		if (option == "--mesoscopic") {
+			options.isMesoscopic = true;
+			continue;
+		}
+		// The last argument is always the output file, never an option's value.
+		if (i + 1 >= argc - 1) {
+			std::cerr << "Option " << option << " needs a value" << std::endl;
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		bool isValid = true;
+		if (option == "--length") {
+			isValid = parseNumber(value, options.laneLength);
+		}
+		else if (option == "--lanes") {
+			isValid = parseNumber(value, options.lanesPerStreet);
+		}
+		else if (option == "--green") {
+			isValid = parseNumber(value, options.greenTicks);
+		}
+		else if (option == "--yellow") {
+			isValid = parseNumber(value, options.yellowTicks);
+		}
+		else if (option == "--all-red") {
+			isValid = parseNumber(value, options.allRedTicks);
+		}
+		else if (option == "--demand") {
+			isValid = parseNumber(value, options.demandPercent);
+		}
+		else if (option == "--buses") {
+			isValid = parseNumber(value, options.busPercent);
+		}
+		else if (option == "--trucks") {
+			isValid = parseNumber(value, options.truckPercent);
+		}
+		else if (option == "--control") {
+			isValid = std::string(value) == "gap" || std::string(value) == "queue";
+			options.control = std::string(value) == "gap" ? Scenario::GapOut : Scenario::QueueLength;
+		}
+		else if (option == "--max-green") {
+			isValid = parseNumber(value, options.maxGreenTicks);
+		}
+		else if (option == "--drop") {
+			isValid = parseNumber(value, options.dropFraction);
+		}
+		else if (option == "--seed") {
+			isValid = parseNumber(value, options.seed);
 		}
+		else {
+			std::cerr << "Unknown option " << option << std::endl;
+			return 1;
+		}
+
+		if (!isValid) {
+			std::cerr << "Invalid value '" << value << "' for " << option << std::endl;
+			return 1;
+		}
+	}
+
+	std::ofstream out(argv[argc - 1], std::ofstream::trunc);
+	if (!out.is_open()) {
+		std::cerr << "Failed to open " << argv[argc - 1] << std::endl;
+		return 1;
+	}
+
+	try {
+		ScenarioGenerator generator(options);
+		generator.write(out);
+		std::cout << "Wrote " << generator.getLaneCount() << " lanes to " << argv[argc - 1] << std::endl;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+// Traffic bench [ticks] [largest grid side] [gap|queue]: runs square grids of doubling size headless and prints one CSV
+// row each, so a ticks/sec scaling curve is one command. gap or queue runs the grids with actuated signals.
+int runBenchmark(int argc, char* argv[])
+{
+	int ticks = argc > 2 ? std::atoi(argv[2]) : 1000;
+	int largest = argc > 3 ? std::atoi(argv[3]) : 16;
+	std::string control = argc > 4 ? argv[4] : "";
+
+	std::cout << "rows,columns,lanes,cars,ticks,ticks_per_second,allocations_per_tick,bytes_per_tick" << std::endl;
+	for (int side = 1; side <= largest; side *= 2) {
+		ScenarioGenerator::Options options;
+		options.rows = side;
+		options.columns = side;
+		if (control == "gap" || control == "queue") {
+			options.control = control == "gap" ? Scenario::GapOut : Scenario::QueueLength;
+		}
+
+		std::stringstream text;
+		ScenarioGenerator(options).write(text);
+		Simulation simulation(Scenario::read(text));
+
+		AllocationTracker::reset();
+		AllocationTracker::start();
+		auto start = std::chrono::steady_clock::now();
+		for (int tick = 0; tick < ticks; tick++) {
+			simulation.tick();
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		AllocationTracker::stop();
+
+		AllocationTracker::Counts allocations = AllocationTracker::getTotal();
+		std::cout << side << "," << side << "," << simulation.getLaneCount() << "," << simulation.getCarCount() << ","
+			<< ticks << "," << ticks / elapsed.count() << "," << static_cast<double>(allocations.allocations) / ticks << ","
+			<< static_cast<double>(allocations.bytes) / ticks << std::endl;
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && std::string(argv[1]) == "metrics") {
+		return runMetricsReader();
+	}
+	if (argc > 1 && std::string(argv[1]) == "decode") {
+		return runDecoder(argc, argv);
+	}
+	if (argc > 1 && std::string(argv[1]) == "generate") {
+		return runGenerator(argc, argv);
+	}
+	if (argc > 1 && std::string(argv[1]) == "bench") {
+		return runBenchmark(argc, argv);
+	}
+
+	Lane::Model laneModel = Lane::Microscopic;
+	Scenario scenario = Scenario::createCross();
+	std::unique_ptr<DemandStream> demand;
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--mesoscopic") {
+			laneModel = Lane::Mesoscopic;
+		}
+		else if (std::string(argv[i]) == "--scenario" && i + 1 < argc) {
+			try {
+				scenario = Scenario::load(argv[++i]);
+			}
+			catch (const std::exception& e) {
+				std::cerr << e.what() << std::endl;
+				return 1;
+			}
+		}
+		else if (std::string(argv[i]) == "--demand" && i + 1 < argc) {
+			demand = std::make_unique<DemandStream>();
+			if (!demand->open(argv[++i])) {
+				std::cerr << "Could not open " << argv[i] << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	ScreenWriter::init();
+	ScreenWriter::clearScreen();
+	Simulation simulation(scenario, laneModel);
+	if (demand != nullptr) {
+		simulation.setDemand(std::move(demand));
+	}
+	Scheduler scheduler;
+	simulation.start(scheduler);
+
+	// Keys the renderer does not use to move the viewport end the run. The scheduler blocks on input between deadlines,
+	// so waiting costs nothing.
+	scheduler.onInput([&scheduler, &simulation]() {
+		while (_kbhit()) {
+			if (!simulation.getRenderer().handleKey(_getch())) {
+				scheduler.stop();
+			}
+		}
+		});
+	try {
+		scheduler.run();
+	}
+	catch (const std::exception& e) {
+		// A malformed demand file is only found when the run reaches the bad line.
+		simulation.stop();
+		std::cerr << e.what() << std::endl;
+		return 1;
 	}
 
 	simulation.stop();
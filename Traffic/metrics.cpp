@@ -0,0 +1,233 @@
+#include "metrics.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	uint32_t getProcessId() {
+#ifdef _WIN32
+		return static_cast<uint32_t>(GetCurrentProcessId());
+#else
+		return static_cast<uint32_t>(getpid());
+#endif
+	}
+
+	bool isProcessRunning(uint32_t pid) {
+#ifdef _WIN32
+		HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+		if (process == nullptr) {
+			return GetLastError() == ERROR_ACCESS_DENIED;
+		}
+		bool isRunning = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+		CloseHandle(process);
+		return isRunning;
+#else
+		return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+#endif
+	}
+
+	// A segment of this layout whose writer has exited. Anything else, including a segment still being set up, is
+	// assumed to be in use.
+	bool isAbandoned(const void* view) {
+		const MetricsSegment* segment = static_cast<const MetricsSegment*>(view);
+		return segment->magic == MetricsSegment::MAGIC && segment->version == MetricsSegment::VERSION
+			&& !isProcessRunning(segment->writerPid);
+	}
+
+#ifndef _WIN32
+	bool isAbandoned(const std::string& path) {
+		int fd = shm_open(path.c_str(), O_RDONLY, 0);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat status {};
+		bool isAbandonedSegment = false;
+		if (fstat(fd, &status) == 0 && status.st_size >= static_cast<off_t>(sizeof(MetricsSegment))) {
+			void* view = mmap(nullptr, sizeof(MetricsSegment), PROT_READ, MAP_SHARED, fd, 0);
+			if (view != MAP_FAILED) {
+				isAbandonedSegment = isAbandoned(view);
+				munmap(view, sizeof(MetricsSegment));
+			}
+		}
+		::close(fd);
+		return isAbandonedSegment;
+	}
+#endif
+}
+
+MetricsSharedMemory::~MetricsSharedMemory() {
+	close();
+}
+
+bool MetricsSharedMemory::create(const std::string& name) {
+	close();
+	_name = name;
+	_isWriter = true;
+
+#ifdef _WIN32
+	std::string path = "Local\\" + name;
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(MetricsSegment), path.c_str());
+	if (mapping == nullptr) {
+		return false;
+	}
+	bool isExisting = GetLastError() == ERROR_ALREADY_EXISTS;
+	void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(MetricsSegment));
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		return false;
+	}
+	// Another writer's segment: attaching to it would overwrite its metrics. One kept alive by a reader after its
+	// writer exited is reused.
+	if (isExisting && !isAbandoned(view)) {
+		UnmapViewOfFile(view);
+		CloseHandle(mapping);
+		return false;
+	}
+	_mapping = mapping;
+#else
+	std::string path = "/" + name;
+	// O_EXCL, so neither writer overwrites the other's metrics nor unlinks the other's segment on close().
+	_fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	// A segment outlives a writer that crashed; remove it and start afresh.
+	if (_fd < 0 && errno == EEXIST && isAbandoned(path)) {
+		shm_unlink(path.c_str());
+		_fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	}
+	if (_fd < 0) {
+		return false;
+	}
+	if (ftruncate(_fd, sizeof(MetricsSegment)) != 0) {
+		close();
+		return false;
+	}
+	void* view = mmap(nullptr, sizeof(MetricsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (view == MAP_FAILED) {
+		close();
+		return false;
+	}
+#endif
+
+	std::memset(view, 0, sizeof(MetricsSegment));
+	_segment = new (view) MetricsSegment();
+	_segment->magic = MetricsSegment::MAGIC;
+	_segment->version = MetricsSegment::VERSION;
+	_segment->writerPid = getProcessId();
+	_segment->sequence.store(0, std::memory_order_release);
+	return true;
+}
+
+bool MetricsSharedMemory::open(const std::string& name) {
+	close();
+	_name = name;
+	_isWriter = false;
+
+#ifdef _WIN32
+	std::string path = "Local\\" + name;
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, path.c_str());
+	if (mapping == nullptr) {
+		return false;
+	}
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(MetricsSegment));
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		return false;
+	}
+	_mapping = mapping;
+#else
+	std::string path = "/" + name;
+	_fd = shm_open(path.c_str(), O_RDONLY, 0);
+	if (_fd < 0) {
+		return false;
+	}
+	void* view = mmap(nullptr, sizeof(MetricsSegment), PROT_READ, MAP_SHARED, _fd, 0);
+	if (view == MAP_FAILED) {
+		close();
+		return false;
+	}
+#endif
+
+	_segment = static_cast<MetricsSegment*>(view);
+	return true;
+}
+
+void MetricsSharedMemory::close() {
+#ifdef _WIN32
+	if (_segment != nullptr) {
+		UnmapViewOfFile(_segment);
+	}
+	if (_mapping != nullptr) {
+		CloseHandle(_mapping);
+		_mapping = nullptr;
+	}
+#else
+	if (_segment != nullptr) {
+		munmap(_segment, sizeof(MetricsSegment));
+	}
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+		if (_isWriter) {
+			shm_unlink(("/" + _name).c_str());
+		}
+	}
+#endif
+	_segment = nullptr;
+}
+
+MetricsSegment& MetricsSharedMemory::beginWrite() {
+	uint64_t sequence = _segment->sequence.load(std::memory_order_relaxed);
+	_segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	return *_segment;
+}
+
+void MetricsSharedMemory::endWrite() {
+	uint64_t sequence = _segment->sequence.load(std::memory_order_relaxed);
+	_segment->sequence.store(sequence + 1, std::memory_order_release);
+}
+
+bool MetricsSharedMemory::read(MetricsSnapshot& snapshot, int maxAttempts) const {
+	if (_segment == nullptr || _segment->magic != MetricsSegment::MAGIC || _segment->version != MetricsSegment::VERSION) {
+		return false;
+	}
+
+	for (int attempt = 0; attempt < maxAttempts; attempt++) {
+		uint64_t before = _segment->sequence.load(std::memory_order_acquire);
+		if (before & 1) {
+			continue;
+		}
+
+		snapshot.tick = _segment->tick;
+		snapshot.ticksPerSecond = _segment->ticksPerSecond;
+		snapshot.carCount = _segment->carCount;
+		snapshot.laneCount = _segment->laneCount;
+		snapshot.totalLaneCount = _segment->totalLaneCount;
+		std::memcpy(snapshot.laneOccupancy, _segment->laneOccupancy, sizeof(snapshot.laneOccupancy));
+		std::memcpy(snapshot.signalState, _segment->signalState, sizeof(snapshot.signalState));
+		std::memcpy(snapshot.phaseElapsed, _segment->phaseElapsed, sizeof(snapshot.phaseElapsed));
+		std::memcpy(snapshot.phaseDuration, _segment->phaseDuration, sizeof(snapshot.phaseDuration));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t after = _segment->sequence.load(std::memory_order_relaxed);
+		if (before == after) {
+			snapshot.sequence = before;
+			return true;
+		}
+	}
+
+	return false;
+}
\ No newline at end of file
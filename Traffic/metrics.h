@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Layout of the shared-memory metrics segment. The simulation thread is the only writer; any number of external
+// processes may map the segment read-only and poll it without ever touching the simulation's locks.
+//
+// Consistency is provided by a seqlock: the writer bumps `sequence` to an odd value, updates the payload, then bumps
+// it to the next even value. A reader copies the payload and retries if the sequence was odd or changed meanwhile.
+//
+// The per-lane arrays hold the first MAX_LANES lanes; `totalLaneCount` says how many the network has, so a reader of a
+// larger network can tell that it sees only part of it.
+struct MetricsSegment {
+	static constexpr uint32_t MAGIC = 0x4D465254; // "TRFM"
+	static constexpr uint32_t VERSION = 2;
+	static constexpr int MAX_LANES = 256;
+	static constexpr uint8_t NO_SIGNAL = 0xFF;
+
+	uint32_t magic;
+	uint32_t version;
+	// Process id of the writer, so a segment left behind by a writer that crashed can be taken over.
+	uint32_t writerPid;
+	std::atomic<uint64_t> sequence;
+
+	// Payload, only valid when read between two equal, even sequence values.
+	uint64_t tick;
+	double ticksPerSecond;
+	uint32_t carCount;
+	// Lanes in the arrays below, at most MAX_LANES, and lanes in the network.
+	uint32_t laneCount;
+	uint32_t totalLaneCount;
+	uint32_t laneOccupancy[MAX_LANES];
+	// Indexed by lane id: the Intersection::Colors value facing cars at the end of the lane, or NO_SIGNAL.
+	uint8_t signalState[MAX_LANES];
+	// Ticks spent showing the current signal color and the total ticks that color lasts.
+	uint32_t phaseElapsed[MAX_LANES];
+	uint32_t phaseDuration[MAX_LANES];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Seqlock counter must be lock-free to live in shared memory");
+
+// Payload copy handed to readers.
+struct MetricsSnapshot {
+	uint64_t sequence = 0;
+	uint64_t tick = 0;
+	double ticksPerSecond = 0.0;
+	uint32_t carCount = 0;
+	uint32_t laneCount = 0;
+	uint32_t totalLaneCount = 0;
+	uint32_t laneOccupancy[MetricsSegment::MAX_LANES] = {};
+	uint8_t signalState[MetricsSegment::MAX_LANES] = {};
+	uint32_t phaseElapsed[MetricsSegment::MAX_LANES] = {};
+	uint32_t phaseDuration[MetricsSegment::MAX_LANES] = {};
+};
+
+// Maps the named segment. The writer creates it; readers open an existing one.
+class MetricsSharedMemory {
+private:
+	MetricsSegment* _segment = nullptr;
+	bool _isWriter = false;
+	std::string _name;
+#ifdef _WIN32
+	void* _mapping = nullptr;
+#else
+	int _fd = -1;
+#endif
+public:
+	inline static const std::string DEFAULT_NAME = "traffic_metrics";
+
+	MetricsSharedMemory() = default;
+	MetricsSharedMemory(const MetricsSharedMemory&) = delete;
+	MetricsSharedMemory& operator=(const MetricsSharedMemory&) = delete;
+	~MetricsSharedMemory();
+
+	// Returns false if the segment cannot be created or already exists, as it does while another simulation publishes
+	// under the same name. A segment whose writer process has exited is taken over.
+	bool create(const std::string& name = DEFAULT_NAME);
+	bool open(const std::string& name = DEFAULT_NAME);
+	void close();
+	bool isOpen() const { return _segment != nullptr; }
+
+	// Writer side. Everything written between beginWrite() and endWrite() becomes visible to readers atomically.
+	MetricsSegment& beginWrite();
+	void endWrite();
+
+	// Reader side. Returns false if the segment is not a valid metrics segment or no consistent copy could be taken.
+	bool read(MetricsSnapshot& snapshot, int maxAttempts = 1000) const;
+};
\ No newline at end of file
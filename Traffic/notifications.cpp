@@ -17,4 +17,10 @@ void Notifications::emit(const std::string& message, const std::any& data) {
 
 void Notifications::subscribe(const std::string& message, Subscriber* subscriber) {
 	_subscriptions[message].push_back(subscriber);
+}
+
+void Notifications::unsubscribe(Subscriber* subscriber) {
+	for (auto& pair : _subscriptions) {
+		std::erase(pair.second, subscriber);
+	}
 }
\ No newline at end of file
@@ -16,6 +16,7 @@ private:
 public:
 	static void emit(const std::string& message, const std::any& data);
 	static void subscribe(const std::string& message, Subscriber* subscriber);
+	static void unsubscribe(Subscriber* subscriber);
 
 	inline const static std::string DELETE_CAR_MESSAGE = "delete_car";
 	inline const static std::string CREATE_CAR_MESSAGE = "create_car";
@@ -1,114 +1,299 @@
 #include "renderer.h"
 #include "screenwriter.h"
+#include "spatial_index.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <string>
+#include <vector>
 
-void Renderer::renderLanes() {
-	for (int i = 0; i < VERT_LANE_HEIGHT; i++) {
-		ScreenWriter::put(40, i + VERT_OFFSET, "|", ScreenWriter::WHITE); // Lane A
-		ScreenWriter::put(42, i + VERT_OFFSET, "|"); // Lane G
-		ScreenWriter::put(40, i + VERT_OFFSET + VERT_LANE_HEIGHT + INTERSECTION_HEIGHT, "|"); // Lane E
-		ScreenWriter::put(42, i + VERT_OFFSET + VERT_LANE_HEIGHT + INTERSECTION_HEIGHT, "|"); // Lane C
+void Renderer::setGeometry(const std::vector<LaneGeometry>& lanes) {
+	_lanes.clear();
+	std::vector<SpatialIndex::Box> boxes;
+	std::vector<SpatialIndex::Segment> segments;
+	std::vector<double> capacities;
+	double totalLength = 0.0;
+
+	for (const LaneGeometry& geometry : lanes) {
+		double dx = geometry.endX - geometry.startX;
+		double dy = geometry.endY - geometry.startY;
+		int length = std::max(geometry.length, 1);
+
+		// Direction in screen cells, which are taller than they are wide.
+		double across = dx;
+		double down = dy / ROW_ASPECT;
+		char glyph = '.';
+		if (across != 0 || down != 0) {
+			if (std::abs(across) >= 2 * std::abs(down)) {
+				glyph = '-';
+			}
+			else if (std::abs(down) >= 2 * std::abs(across)) {
+				glyph = '|';
+			}
+			else {
+				glyph = (across > 0) == (down > 0) ? '\\' : '/';
+			}
+		}
+
+		// On screen y grows downwards, so the drivers' right of (across, down) is (-down, across).
+		double norm = std::hypot(across, down);
+		int offsetColumn = 0;
+		int offsetRow = 0;
+		if (norm > 0) {
+			double cells = geometry.lateralIndex + 1.0;
+			offsetColumn = static_cast<int>(std::lround(-down / norm * cells));
+			offsetRow = static_cast<int>(std::lround(across / norm * cells));
+		}
+
+		_lanes.push_back({ geometry.startX, geometry.startY, dx / length, dy / length, length, glyph, offsetColumn, offsetRow });
+		boxes.push_back({ std::min(geometry.startX, geometry.endX), std::min(geometry.startY, geometry.endY),
+			std::max(geometry.startX, geometry.endX), std::max(geometry.startY, geometry.endY) });
+		// Density is the share of the lane's cells, 0 to length, that hold a car.
+		segments.push_back({ geometry.startX, geometry.startY, geometry.endX, geometry.endY });
+		capacities.push_back(length + 1.0);
+		totalLength += std::hypot(dx, dy);
+	}
+
+	// Buckets about a lane long keep each lane in a few buckets and each bucket to a few lanes.
+	double bucketSize = lanes.empty() ? 1.0 : std::max(1.0, totalLength / lanes.size());
+	_index.build(boxes, bucketSize);
+	_index.setSegments(segments, capacities);
+	_visibleLanes.reserve(lanes.size());
+	_isFitPending = true;
+}
+
+void Renderer::pan(double across, double down) {
+	_centerX += across * std::max(mapColumns(), 1) * _scale;
+	_centerY += down * std::max(mapRows(), 1) * _scale * ROW_ASPECT;
+}
+
+void Renderer::zoom(double factor) {
+	_scale = std::clamp(_scale / factor, 0.05, 1e6);
+}
+
+bool Renderer::handleKey(int key) {
+	switch (key) {
+	case 'w': case 'W':
+		pan(0, -0.25);
+		return true;
+	case 's': case 'S':
+		pan(0, 0.25);
+		return true;
+	case 'a': case 'A':
+		pan(-0.25, 0);
+		return true;
+	case 'd': case 'D':
+		pan(0.25, 0);
+		return true;
+	case '+': case '=':
+		zoom(1.5);
+		return true;
+	case '-': case '_':
+		zoom(1 / 1.5);
+		return true;
+	case 'f': case 'F':
+		fit();
+		return true;
+	default:
+		return false;
+	}
+}
+
+Renderer::Cell* Renderer::findCell(int column, int row) {
+	if (column < 0 || column >= _columns || row < 0 || row >= _rows) {
+		return nullptr;
 	}
+	return &_frame[static_cast<size_t>(row) * _columns + column];
+}
 
-	for (int i = 0; i < HORIZ_LANE_LENGTH; i++) {
-		ScreenWriter::put(i + HORIZ_OFFSET, 21, "-"); // Lane H
-		ScreenWriter::put(i + HORIZ_OFFSET, 22, "-"); // Lane B
-		ScreenWriter::put(i + HORIZ_OFFSET + HORIZ_LANE_LENGTH + INTERSECTION_WIDTH, 21, "-"); // Lane D
-		ScreenWriter::put(i + HORIZ_OFFSET + HORIZ_LANE_LENGTH + INTERSECTION_WIDTH, 22, "-"); // Lane F
+void Renderer::put(int column, int row, char glyph, Layer layer, const std::string* color) {
+	// Cars stay on top of signals, and signals on top of road.
+	if (Cell* cell = findCell(column, row); cell != nullptr && layer >= cell->layer) {
+		cell->glyph = glyph;
+		cell->layer = layer;
+		cell->color = color;
 	}
 }
 
-void Renderer::renderStopLight(Axis a, const std::string& color) {
-	switch (a) {
-	case Top:
-		ScreenWriter::put(40, 20, "---", color);
-		break;
-	case Left:
-		ScreenWriter::put(39, 21, "|", color);
-		ScreenWriter::put(39, 22, "|", color);
-		break;
-	case Right:
-		ScreenWriter::put(43, 21, "|", color);
-		ScreenWriter::put(43, 22, "|", color);
-		break;
-	case Bottom:
-		ScreenWriter::put(40, 23, "---", color);
-		break;
+void Renderer::text(int column, int row, const std::string& text, const std::string* color) {
+	for (char c : text) {
+		put(column++, row, c, CarLayer, color);
 	}
 }
 
-void Renderer::renderCar(Axis a, Heading h, int pos, int laneLength) {
-	int row = 0;
-	int col = 0;
-
-	switch (h) {
-	case In:
-		switch (a) {
-		case Top:
-			col = 40;
-			row = static_cast<int>(pos * (VERT_LANE_HEIGHT - 1) / laneLength + VERT_OFFSET);
-			break;
-		case Left:
-			row = 22;
-			col = static_cast<int>(pos * (HORIZ_LANE_LENGTH - 1) / laneLength + HORIZ_OFFSET);
-			break;
-		case Bottom:
-			col = 42;
-			row = static_cast<int>(VERT_OFFSET + INTERSECTION_HEIGHT + (VERT_LANE_HEIGHT * 2) - (pos * (VERT_LANE_HEIGHT - 1) / laneLength) - 1);
-			break;
-		case Right:
-			row = 21;
-			col = static_cast<int>(HORIZ_OFFSET + INTERSECTION_WIDTH + (HORIZ_LANE_LENGTH * 2) - (pos * (HORIZ_LANE_LENGTH - 1) / laneLength) - 1);
-			break;
+template <typename Draw>
+void Renderer::trace(const LaneShape& lane, bool isOffset, Draw draw) {
+	double rowScale = _scale * ROW_ASPECT;
+	double startColumn = (lane.startX - left()) / _scale + (isOffset ? lane.offsetColumn : 0);
+	double startRow = (lane.startY - top()) / rowScale + (isOffset ? lane.offsetRow : 0);
+	double spanColumns = lane.stepX * lane.length / _scale;
+	double spanRows = lane.stepY * lane.length / rowScale;
+
+	// Only the part of the lane inside the map area is walked, however far the lane extends past it.
+	double first = 0.0;
+	double last = 1.0;
+	auto clip = [&first, &last](double start, double span, double low, double high) {
+		if (span == 0) {
+			if (start < low || start >= high) {
+				last = -1.0;
+			}
+			return;
+		}
+		double enter = (low - start) / span;
+		double leave = (high - start) / span;
+		first = std::max(first, std::min(enter, leave));
+		last = std::min(last, std::max(enter, leave));
+	};
+	clip(startColumn, spanColumns, -0.5, mapColumns() - 0.5);
+	clip(startRow, spanRows, -0.5, mapRows() - 0.5);
+	if (first > last) {
+		return;
+	}
+
+	int steps = static_cast<int>(std::ceil(std::max(std::abs(spanColumns), std::abs(spanRows)) * (last - first)));
+	for (int i = 0; i <= steps; i++) {
+		double t = steps == 0 ? first : first + (last - first) * i / steps;
+		int column = static_cast<int>(std::lround(startColumn + spanColumns * t));
+		int row = static_cast<int>(std::lround(startRow + spanRows * t));
+		if (column >= 0 && column < mapColumns() && row >= 0 && row < mapRows()) {
+			draw(PANEL_WIDTH + column, row);
 		}
-		break;
-	case Out:
-		switch (a) {
-		case Top:
-			col = 42;
-			row = static_cast<int>(VERT_OFFSET + VERT_LANE_HEIGHT - (pos * (VERT_LANE_HEIGHT - 1) / laneLength) - 1);
-			break;
-		case Left:
-			row = 21;
-			col = static_cast<int>(HORIZ_OFFSET + HORIZ_LANE_LENGTH - (pos * (HORIZ_LANE_LENGTH - 1) / laneLength) - 1);
-			break;
-		case Bottom:
-			col = 40;
-			row = static_cast<int>((pos * (VERT_LANE_HEIGHT - 1) / laneLength) + VERT_OFFSET + VERT_LANE_HEIGHT + INTERSECTION_HEIGHT);
-			break;
-		case Right:
-			row = 22;
-			col = static_cast<int>((pos * (HORIZ_LANE_LENGTH - 1) / laneLength) + HORIZ_OFFSET + HORIZ_LANE_LENGTH + INTERSECTION_WIDTH);
-			break;
+	}
+}
+
+const std::vector<int>& Renderer::beginFrame(int columns, int rows) {
+	columns = std::max(columns, PANEL_WIDTH + 1);
+	rows = std::max(rows, 2);
+	if (columns != _columns || rows != _rows) {
+		_columns = columns;
+		_rows = rows;
+		_frame.resize(static_cast<size_t>(_columns) * _rows);
+	}
+	std::fill(_frame.begin(), _frame.end(), Cell { ' ', EmptyLayer, nullptr });
+
+	if (_isFitPending) {
+		const SpatialIndex::Box& bounds = _index.getBounds();
+		_centerX = (bounds.left + bounds.right) / 2;
+		_centerY = (bounds.top + bounds.bottom) / 2;
+		// A little margin so the lanes drawn beside the outermost streets stay on screen.
+		_scale = std::max({ (bounds.right - bounds.left) / mapColumns(), (bounds.bottom - bounds.top) / (mapRows() * ROW_ASPECT), 0.05 }) * 1.1;
+		_isFitPending = false;
+	}
+
+	// Zoomed out the frame is drawn from the heatmap alone, so no lane is visited.
+	_visibleLanes.clear();
+	if (!isDetailed()) {
+		return _visibleLanes;
+	}
+
+	// Widened by a few cells to catch lanes drawn beside streets just off screen.
+	double marginX = 4 * _scale;
+	double marginY = 4 * _scale * ROW_ASPECT;
+	_index.query({ left() - marginX, top() - marginY, left() + mapColumns() * _scale + marginX,
+		top() + mapRows() * _scale * ROW_ASPECT + marginY }, _visibleLanes);
+	return _visibleLanes;
+}
+
+void Renderer::drawLane(int lane, const std::string* signalColor) {
+	const LaneShape& shape = _lanes[lane];
+	trace(shape, true, [this, &shape](int column, int row) { put(column, row, shape.glyph, LaneLayer, nullptr); });
+
+	if (signalColor != nullptr) {
+		// The signal is shown on the cell where the lane meets its intersection.
+		double endX = shape.startX + shape.stepX * shape.length;
+		double endY = shape.startY + shape.stepY * shape.length;
+		int column = static_cast<int>(std::lround((endX - left()) / _scale)) + shape.offsetColumn;
+		int row = static_cast<int>(std::lround((endY - top()) / (_scale * ROW_ASPECT))) + shape.offsetRow;
+		if (column >= 0 && column < mapColumns() && row >= 0 && row < mapRows()) {
+			put(PANEL_WIDTH + column, row, '#', SignalLayer, signalColor);
 		}
-		break;
 	}
+}
+
+void Renderer::drawCar(int lane, int position, char glyph) {
+	const LaneShape& shape = _lanes[lane];
+	double x = shape.startX + shape.stepX * position;
+	double y = shape.startY + shape.stepY * position;
+	int column = static_cast<int>(std::lround((x - left()) / _scale)) + shape.offsetColumn;
+	int row = static_cast<int>(std::lround((y - top()) / (_scale * ROW_ASPECT))) + shape.offsetRow;
+	if (column >= 0 && column < mapColumns() && row >= 0 && row < mapRows()) {
+		put(PANEL_WIDTH + column, row, glyph, CarLayer, &ScreenWriter::BLUE);
+	}
+}
+
+void Renderer::drawDensity() {
+	static const char SHADES[] = ".:-=+*#%@";
+	static constexpr int SHADE_COUNT = sizeof(SHADES) - 1;
 
-	ScreenWriter::put(col, row, "O", ScreenWriter::BLUE);
+	double rowScale = _scale * ROW_ASPECT;
+	for (int row = 0; row < mapRows(); row++) {
+		for (int column = 0; column < mapColumns(); column++) {
+			// The world area under the cell, centred where trace() would put a point drawn in it.
+			double x = left() + column * _scale;
+			double y = top() + row * rowScale;
+			double load = 0.0;
+			double capacity = 0.0;
+			_index.sumLoad({ x - _scale / 2, y - rowScale / 2, x + _scale / 2, y + rowScale / 2 }, load, capacity);
+			if (capacity <= 0) {
+				continue;
+			}
+
+			double density = load / capacity;
+			int shade = std::clamp(static_cast<int>(density * SHADE_COUNT), 0, SHADE_COUNT - 1);
+			const std::string* color = density <= 0 ? nullptr : shade < SHADE_COUNT / 3 ? &ScreenWriter::GREEN
+				: shade < 2 * SHADE_COUNT / 3 ? &ScreenWriter::YELLOW : &ScreenWriter::RED;
+			*findCell(PANEL_WIDTH + column, row) = { SHADES[shade], LaneLayer, color };
+		}
+	}
 }
 
 void Renderer::renderVolumeGraph(int volume) {
-	for (int i = 3; i < 18; i++) {
-		ScreenWriter::put(10, i, "|                   ", ScreenWriter::WHITE);
+	for (int row = 2; row < 17; row++) {
+		text(1, row, "|", nullptr);
 	}
-	ScreenWriter::put(10, 18, "--------------------");
-	ScreenWriter::put(12, 19, "Traffic volume");
+	text(1, 17, "--------------------", nullptr);
+	text(3, 18, "Traffic volume", nullptr);
 
 	_historicalVolume.push_back(volume);
 	if (_historicalVolume.size() > 19) {
 		_historicalVolume.pop_front();
 	}
 
-	int col = 11;
+	int column = 2;
 	for (int volume : _historicalVolume) {
-		int row = 17 - (static_cast<int>(volume) / 10);
-		std::string color = ScreenWriter::WHITE;
-		if (row < 3) {
-			row = 3;
-			color = ScreenWriter::RED;
+		int row = 16 - (static_cast<int>(volume) / 10);
+		put(column, std::max(row, 2), '-', CarLayer, row < 2 ? &ScreenWriter::RED : nullptr);
+		column++;
+	}
+}
+
+void Renderer::present(uint64_t tick, int carCount) {
+	std::string status = "tick " + std::to_string(tick) + "  cars " + std::to_string(carCount) + "  "
+		+ (isDetailed() ? "cars" : "density") + " at " + std::to_string(_scale).substr(0, 5)
+		+ " units/column   w/a/s/d pan  +/- zoom  f fit  other keys quit";
+	text(1, _rows - 1, status, nullptr);
+
+	for (int row = 0; row < _rows; row++) {
+		_line.clear();
+		const std::string* current = nullptr;
+		_line += ScreenWriter::WHITE;
+		for (int column = 0; column < _columns; column++) {
+			const Cell& cell = _frame[static_cast<size_t>(row) * _columns + column];
+			if (cell.color != current) {
+				current = cell.color;
+				_line += current != nullptr ? *current : ScreenWriter::WHITE;
+			}
+			_line += cell.glyph;
 		}
-		ScreenWriter::put(col, row, "-", color);
-		col++;
+		_line += ScreenWriter::WHITE;
+		ScreenWriter::put(1, row + 1, _line);
 	}
 }
+
+char Renderer::getGlyph(int column, int row) const {
+	if (column < 0 || column >= _columns || row < 0 || row >= _rows) {
+		return ' ';
+	}
+	return _frame[static_cast<size_t>(row) * _columns + column].glyph;
+}
\ No newline at end of file
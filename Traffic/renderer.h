@@ -1,22 +1,114 @@
 #pragma once
-#include <string>
+#include "spatial_index.h"
+
+#include <cstdint>
 #include <deque>
+#include <string>
+#include <vector>
 
+// Draws a viewport onto the network into a character frame, then writes the frame to the console in one pass.
+//
+// Lane geometry is precomputed once: each lane's start point and step per cell of its length in world coordinates, its
+// glyph, and its sideways offset in screen cells (lanes are drawn beside their street's centre line, on the right of
+// the direction of travel, one cell apart). A SpatialIndex over the lanes' bounding boxes finds the lanes under the
+// viewport, so only those are visited, and every car on them is drawn. Zoomed out past DETAIL_SCALE, no lane is visited:
+// each screen cell is shaded by the density of all the lanes under it, read from the index's heatmap, which the lanes
+// keep current as cars enter and leave them (Lane::setOccupancyIndex). Either way the work per frame follows the size
+// of the screen, not the size of the network.
 class Renderer
 {
+public:
+	// Where a lane runs, from the node at its beginning to the node at its end. lateralIndex is the lane's place on its
+	// road counting from the drivers' left (0 for a lane with no road).
+	struct LaneGeometry {
+		double startX;
+		double startY;
+		double endX;
+		double endY;
+		int length;
+		int lateralIndex;
+	};
+
+	// World units across one screen column, past which cars are no longer drawn one by one.
+	static constexpr double DETAIL_SCALE = 4.0;
+	// A character cell is about twice as tall as it is wide.
+	static constexpr double ROW_ASPECT = 2.0;
+	// Columns on the left reserved for the volume graph.
+	static constexpr int PANEL_WIDTH = 24;
 private:
-	static constexpr int VERT_LANE_HEIGHT = 15;
-	static constexpr int HORIZ_LANE_LENGTH = 22;
-	static constexpr int VERT_OFFSET = 5;
-	static constexpr int HORIZ_OFFSET = 17;
-	static constexpr int INTERSECTION_HEIGHT = 4;
-	static constexpr int INTERSECTION_WIDTH = 5;
+	enum Layer : uint8_t { EmptyLayer, LaneLayer, SignalLayer, CarLayer };
+
+	struct Cell {
+		char glyph;
+		Layer layer;
+		const std::string* color;
+	};
+
+	struct LaneShape {
+		double startX;
+		double startY;
+		double stepX;
+		double stepY;
+		int length;
+		char glyph;
+		int offsetColumn;
+		int offsetRow;
+	};
+
+	std::vector<LaneShape> _lanes;
+	SpatialIndex _index;
+	std::vector<int> _visibleLanes;
+
+	// Viewport: world point at the centre of the map area and world units per column.
+	double _centerX = 0.0;
+	double _centerY = 0.0;
+	double _scale = 1.0;
+	bool _isFitPending = true;
+
+	// Frame of _columns x _rows cells; the map area is to the right of the panel and above the status line.
+	int _columns = 0;
+	int _rows = 0;
+	std::vector<Cell> _frame;
+	std::string _line;
 	std::deque<int> _historicalVolume;
+
+	int mapColumns() const { return _columns - PANEL_WIDTH; }
+	int mapRows() const { return _rows - 1; }
+	double left() const { return _centerX - mapColumns() * _scale / 2; }
+	double top() const { return _centerY - mapRows() * _scale * ROW_ASPECT / 2; }
+	Cell* findCell(int column, int row);
+	void put(int column, int row, char glyph, Layer layer, const std::string* color);
+	void text(int column, int row, const std::string& text, const std::string* color);
+	// Calls draw(column, row), in frame coordinates, for each map cell the lane covers; isOffset draws it beside the
+	// street's centre line rather than on it.
+	template <typename Draw>
+	void trace(const LaneShape& lane, bool isOffset, Draw draw);
 public:
-	enum Axis { Top, Left, Right, Bottom };
-	enum Heading { In, Out };
-	void renderLanes();
-	void renderStopLight(Axis a, const std::string& color);
-	void renderCar(Axis a, Heading h, int pos, int laneLength);
+	// Replaces the geometry table and rebuilds the spatial index. The next frame shows the whole network.
+	void setGeometry(const std::vector<LaneGeometry>& lanes);
+
+	void fit() { _isFitPending = true; }
+	// Moves the viewport by a fraction of its width and height.
+	void pan(double across, double down);
+	// Factors above 1 zoom in.
+	void zoom(double factor);
+	// w/a/s/d pan, +/- zoom, f fits the network to the screen. Returns false for any other key.
+	bool handleKey(int key);
+	bool isDetailed() const { return _scale <= DETAIL_SCALE; }
+	double getScale() const { return _scale; }
+
+	// Item i is lane i, and its heatmap load is the number of cars on it.
+	SpatialIndex& getIndex() { return _index; }
+
+	// Starts a frame of the given console size and returns the lanes under the viewport, or none when zoomed out.
+	const std::vector<int>& beginFrame(int columns, int rows);
+	// signalColor is the color of the signal at the lane's end, or nullptr if there is none.
+	void drawLane(int lane, const std::string* signalColor);
+	void drawCar(int lane, int position, char glyph = 'O');
+	// Zoomed out only. Shades each map cell by the share of the lane cells under it that hold a car.
+	void drawDensity();
 	void renderVolumeGraph(int volume);
+	// Adds the status line and writes the frame to the console.
+	void present(uint64_t tick, int carCount);
+	char getGlyph(int column, int row) const;
 };
\ No newline at end of file
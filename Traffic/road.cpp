@@ -0,0 +1,162 @@
+#include "road.h"
+#include "routing.h"
+#include "simulation.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+Road::Road(const std::vector<Lane*>& lanes) : _lanes(lanes), _next(lanes.size()), _ahead(lanes.size()), _arrivals(lanes.size()), _isChanged(lanes.size()) {
+	if (lanes.size() < 2) {
+		throw std::invalid_argument("A road needs at least two lanes");
+	}
+
+	for (Lane* lane : lanes) {
+		if (&lane->getBeginning() != &lanes.front()->getBeginning() || &lane->getEnd() != &lanes.front()->getEnd()) {
+			throw std::invalid_argument("The lanes of a road must share a beginning and an end");
+		}
+	}
+	for (size_t i = 0; i < lanes.size(); i++) {
+		_arrivals[i].reserve(lanes[i]->getLength() + 1);
+	}
+}
+
+int Road::safeGap() const {
+	// Far enough that neither the car nor the one behind it can reach the other's cells on the next tick.
+	return 2 * MAX_VEHICLE_SPEED;
+}
+
+int Road::tailOf(const Car* car) {
+	return car->getPosition() - car->getLength() + 1;
+}
+
+int Road::gapBeside(size_t index, const Car* car) {
+	const std::vector<Car*>& cars = _lanes[index]->getCars();
+	int position = car->getPosition();
+	size_t& ahead = _ahead[index];
+	while (ahead < cars.size() && cars[ahead]->getPosition() > position) {
+		ahead++;
+	}
+
+	// Gaps run from tail to front: the leader's tail ahead of the car, and the car's tail ahead of the follower.
+	int leaderGap = ahead > 0 ? tailOf(cars[ahead - 1]) - position : _lanes[index]->getLength() - position + safeGap();
+	bool isFollowerClear = ahead == cars.size() || tailOf(car) - cars[ahead]->getPosition() >= safeGap();
+	return leaderGap >= safeGap() && isFollowerClear ? leaderGap : -1;
+}
+
+const std::vector<Road::LaneChange>& Road::changeLanes(const Router& router) {
+	static constexpr size_t NONE = static_cast<size_t>(-1);
+
+	_changes.clear();
+	for (Lane* lane : _lanes) {
+		if (lane->getModel() != Lane::Microscopic) {
+			return _changes;
+		}
+	}
+	std::fill(_next.begin(), _next.end(), 0);
+	std::fill(_ahead.begin(), _ahead.end(), 0);
+
+	while (true) {
+		// Merge step: the car furthest along the road that has not been considered yet.
+		size_t lane = NONE;
+		int position = -1;
+		for (size_t i = 0; i < _lanes.size(); i++) {
+			const std::vector<Car*>& cars = _lanes[i]->getCars();
+			if (_next[i] < cars.size() && cars[_next[i]]->getPosition() > position) {
+				lane = i;
+				position = cars[_next[i]]->getPosition();
+			}
+		}
+		if (lane == NONE) {
+			break;
+		}
+
+		const std::vector<Car*>& cars = _lanes[lane]->getCars();
+		size_t index = _next[lane]++;
+		Car* car = cars[index];
+
+		int destination = car->getDestination();
+		bool isRouted = destination >= 0 && destination < router.getDestinationCount();
+		auto canReach = [&](size_t i) {
+			return !isRouted || router.getDistance(_lanes[i], destination) < Router::UNREACHABLE;
+		};
+
+		// A car on a lane that cannot reach its destination heads for the nearest lane that can.
+		size_t target = NONE;
+		if (!canReach(lane)) {
+			for (size_t distance = 1; distance < _lanes.size() && target == NONE; distance++) {
+				if (lane >= distance && canReach(lane - distance)) {
+					target = lane - 1;
+				}
+				else if (lane + distance < _lanes.size() && canReach(lane + distance)) {
+					target = lane + 1;
+				}
+			}
+		}
+
+		int ownGap = index > 0 ? tailOf(cars[index - 1]) - position : _lanes[lane]->getLength() - position + safeGap();
+		bool isHeldUp = ownGap <= car->getParameters().maxSpeed;
+		if (target == NONE && !isHeldUp) {
+			continue;
+		}
+
+		size_t best = NONE;
+		if (target != NONE) {
+			if (gapBeside(target, car) >= 0) {
+				best = target;
+			}
+		}
+		else {
+			// Only worth it if the other lane is clearly better, so cars do not weave back and forth.
+			int bestGap = ownGap + safeGap() - 1;
+			for (size_t neighbor : { lane - 1, lane + 1 }) {
+				if (neighbor >= _lanes.size() || !canReach(neighbor)) {
+					continue;
+				}
+				int gap = gapBeside(neighbor, car);
+				if (gap > bestGap) {
+					best = neighbor;
+					bestGap = gap;
+				}
+			}
+		}
+
+		if (best != NONE) {
+			_changes.push_back({ car, _lanes[lane], _lanes[best] });
+		}
+	}
+
+	for (std::vector<Car*>& arrivals : _arrivals) {
+		arrivals.clear();
+	}
+	std::fill(_isChanged.begin(), _isChanged.end(), false);
+
+	size_t kept = 0;
+	for (const LaneChange& change : _changes) {
+		// Every change was judged safe against the lanes as they were, so only a car that moved in ahead of this one
+		// earlier on this pass can have taken the gap. Changes are in order from the front of the road, so that is the
+		// last car to have moved into the lane.
+		size_t to = std::find(_lanes.begin(), _lanes.end(), change.to) - _lanes.begin();
+		std::vector<Car*>& arrivals = _arrivals[to];
+		if (!arrivals.empty() && tailOf(arrivals.back()) - change.car->getPosition() < safeGap()) {
+			continue;
+		}
+
+		arrivals.push_back(change.car);
+		change.car->setLane(change.to);
+		_isChanged[to] = true;
+		_isChanged[std::find(_lanes.begin(), _lanes.end(), change.from) - _lanes.begin()] = true;
+		_changes[kept++] = change;
+	}
+	_changes.resize(kept);
+
+	// Each lane is rebuilt once, however many cars left or joined it.
+	for (size_t i = 0; i < _lanes.size(); i++) {
+		if (_isChanged[i]) {
+			_lanes[i]->exchangeCars(_arrivals[i]);
+		}
+	}
+
+	return _changes;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+class Car;
+class Lane;
+class Router;
+
+// Parallel microscopic lanes that share a beginning and an end, listed from the drivers' left to their right. A car may
+// change to an adjacent lane, keeping its position and speed, when the gaps to the leader and follower there are safe
+// and either its own lane cannot reach its destination or it is held up and the other lane is clearer. Gaps are measured
+// between one car's front and the next car's tail, so long vehicles need longer gaps.
+//
+// Every lane keeps its cars sorted by position, front first. changeLanes() merges those lists into one pass from the
+// front of the road to the back, carrying a cursor per lane that only ever moves backwards; the leader and follower
+// beside a car are then the cars either side of the neighbouring lanes' cursors, so each query is amortized constant
+// time. The changes are then applied by rebuilding each changed lane once, merging its arrivals into the cars that stay,
+// so the whole pass is linear in the number of cars on the road however many of them change lanes.
+class Road {
+public:
+	struct LaneChange {
+		Car* car;
+		Lane* from;
+		Lane* to;
+	};
+private:
+	std::vector<Lane*> _lanes;
+	// Per lane: the next car the merge will visit, and how many cars are ahead of the car being considered.
+	std::vector<size_t> _next;
+	std::vector<size_t> _ahead;
+	std::vector<LaneChange> _changes;
+	// Per lane: the cars joining it on this pass, front first, and whether any car joins or leaves it.
+	std::vector<std::vector<Car*>> _arrivals;
+	std::vector<bool> _isChanged;
+
+	int safeGap() const;
+	// The rearmost cell a car occupies.
+	static int tailOf(const Car* car);
+	// How far `car` could go on lane `index` before reaching the car ahead. Returns -1 if the change is unsafe. Advances
+	// the lane's cursor to the car's position.
+	int gapBeside(size_t index, const Car* car);
+public:
+	// Throws std::invalid_argument unless there are at least two lanes with the same beginning and end.
+	explicit Road(const std::vector<Lane*>& lanes);
+	const std::vector<Lane*>& getLanes() const { return _lanes; }
+
+	// Decides lane changes for every car on the road, then carries them out. The result is valid until the next call.
+	const std::vector<LaneChange>& changeLanes(const Router& router);
+};
\ No newline at end of file
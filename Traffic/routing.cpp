@@ -0,0 +1,213 @@
+#include "routing.h"
+#include "simulation.h"
+#include "traffic_nodes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+void Router::build(const std::vector<Lane*>& lanes) {
+	_links.clear();
+	_links.reserve(lanes.size());
+	_destinationCount = 0;
+	_pendingChanges.clear();
+
+	for (int i = 0; i < static_cast<int>(lanes.size()); i++) {
+		Lane* lane = lanes[i];
+		if (lane->getId() != i) {
+			throw std::invalid_argument("Router requires lane ids to match their index");
+		}
+
+		Link link { lane, dynamic_cast<Intersection*>(&lane->getEnd()), -1, 0.0, {}, {} };
+		if (Terminal* terminal = dynamic_cast<Terminal*>(&lane->getEnd()); terminal != nullptr) {
+			link.terminal = terminal->getId();
+			_destinationCount = std::max(_destinationCount, link.terminal + 1);
+		}
+		// Free-flow travel time, the same for either lane model.
+		link.cost = static_cast<double>(lane->getLength() / Car::getCruiseSpeed() + 1);
+		_links.push_back(std::move(link));
+	}
+
+	for (Link& link : _links) {
+		if (link.intersection == nullptr) {
+			continue;
+		}
+
+		const std::vector<Lane*>& exits = link.intersection->getExits(link.lane);
+		if (exits.size() >= Intersection::NO_ROUTE) {
+			throw std::invalid_argument("Too many exits from one lane for the next-hop table");
+		}
+		for (Lane* exit : exits) {
+			link.successors.push_back(exit->getId());
+			_links[exit->getId()].predecessors.push_back(link.lane->getId());
+		}
+	}
+
+	for (Link& link : _links) {
+		if (link.intersection != nullptr) {
+			link.intersection->setDestinationCount(_destinationCount);
+		}
+	}
+
+	_distance.assign(static_cast<size_t>(_destinationCount) * _links.size(), UNREACHABLE);
+	_nextExit.assign(static_cast<size_t>(_destinationCount) * _links.size(), Intersection::NO_ROUTE);
+
+	std::vector<int> all(_destinationCount);
+	for (int d = 0; d < _destinationCount; d++) {
+		all[d] = d;
+	}
+	computeDestinations(all);
+}
+
+void Router::computeDestination(int destination) {
+	using Entry = std::pair<double, int>;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> frontier;
+
+	for (int i = 0; i < static_cast<int>(_links.size()); i++) {
+		_distance[cell(destination, i)] = UNREACHABLE;
+		_nextExit[cell(destination, i)] = Intersection::NO_ROUTE;
+
+		if (_links[i].terminal == destination) {
+			_distance[cell(destination, i)] = _links[i].cost;
+			frontier.push({ _links[i].cost, i });
+		}
+	}
+
+	// Reverse Dijkstra: settle a link, then relax every lane that can turn into it.
+	while (!frontier.empty()) {
+		auto [distance, link] = frontier.top();
+		frontier.pop();
+		if (distance > _distance[cell(destination, link)]) {
+			continue;
+		}
+
+		for (int predecessor : _links[link].predecessors) {
+			const Link& from = _links[predecessor];
+			double through = from.cost + distance;
+			if (through < _distance[cell(destination, predecessor)]) {
+				_distance[cell(destination, predecessor)] = through;
+				auto exit = std::find(from.successors.begin(), from.successors.end(), link);
+				_nextExit[cell(destination, predecessor)] = static_cast<uint8_t>(exit - from.successors.begin());
+				frontier.push({ through, predecessor });
+			}
+		}
+	}
+
+	for (int i = 0; i < static_cast<int>(_links.size()); i++) {
+		if (_links[i].intersection != nullptr) {
+			_links[i].intersection->setNextHop(_links[i].lane, destination, _nextExit[cell(destination, i)]);
+		}
+	}
+}
+
+void Router::computeDestinations(const std::vector<int>& destinations) {
+	// Each destination only writes its own slice of the tables, so workers need no locking beyond the shared cursor.
+	std::atomic<size_t> next = 0;
+	auto worker = [this, &destinations, &next]() {
+		for (size_t i = next++; i < destinations.size(); i = next++) {
+			computeDestination(destinations[i]);
+		}
+	};
+
+	size_t workers = std::min<size_t>(destinations.size(), std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::future<void>> running;
+	for (size_t i = 1; i < workers; i++) {
+		running.push_back(std::async(std::launch::async, worker));
+	}
+	worker();
+	for (std::future<void>& future : running) {
+		future.get();
+	}
+}
+
+double Router::getLinkCost(const Lane* lane) const {
+	return _links.at(lane->getId()).cost;
+}
+
+void Router::setLinkCost(const Lane* lane, double cost) {
+	Link& link = _links.at(lane->getId());
+	bool isPending = std::any_of(_pendingChanges.begin(), _pendingChanges.end(), [lane](const CostChange& change) {
+		return change.link == lane->getId();
+		});
+	if (!isPending) {
+		_pendingChanges.push_back({ lane->getId(), link.cost });
+	}
+	link.cost = cost;
+}
+
+bool Router::isAffected(int destination, const CostChange& change) const {
+	int changed = change.link;
+	double oldDistance = _distance[cell(destination, changed)];
+	if (oldDistance >= UNREACHABLE) {
+		return false;
+	}
+
+	// Is the link on this destination's shortest-path tree, i.e. does any lane currently route through it?
+	for (int predecessor : _links[changed].predecessors) {
+		uint8_t exit = _nextExit[cell(destination, predecessor)];
+		if (exit != Intersection::NO_ROUTE && _links[predecessor].successors[exit] == changed) {
+			return true;
+		}
+	}
+
+	// Off the tree, a more expensive link changes nothing. A cheaper one matters only if some lane would now prefer it.
+	double newDistance = oldDistance - change.oldCost + _links[changed].cost;
+	for (int predecessor : _links[changed].predecessors) {
+		if (_links[predecessor].cost + newDistance < _distance[cell(destination, predecessor)]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int Router::refresh() {
+	if (_pendingChanges.empty()) {
+		return 0;
+	}
+
+	std::vector<int> affected;
+	for (int d = 0; d < _destinationCount; d++) {
+		bool isDestinationAffected = std::any_of(_pendingChanges.begin(), _pendingChanges.end(), [this, d](const CostChange& change) {
+			return isAffected(d, change);
+			});
+
+		if (isDestinationAffected) {
+			affected.push_back(d);
+			continue;
+		}
+
+		// Nobody routes through the changed links, so only their own distances move.
+		for (const CostChange& change : _pendingChanges) {
+			double& distance = _distance[cell(d, change.link)];
+			if (distance < UNREACHABLE) {
+				distance += _links[change.link].cost - change.oldCost;
+			}
+		}
+	}
+
+	_pendingChanges.clear();
+	computeDestinations(affected);
+	return static_cast<int>(affected.size());
+}
+
+double Router::getDistance(const Lane* lane, int destination) const {
+	return _distance.at(cell(destination, lane->getId()));
+}
+
+std::vector<int> Router::getReachableDestinations(const Lane* lane) const {
+	std::vector<int> reachable;
+	for (int d = 0; d < _destinationCount; d++) {
+		if (getDistance(lane, d) < UNREACHABLE) {
+			reachable.push_back(d);
+		}
+	}
+	return reachable;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Intersection;
+class Lane;
+
+// Builds the per-destination next-hop tables used by Intersection::route().
+//
+// The graph is the lane graph: each Lane is a link, and an Intersection connection from one lane to another is an edge.
+// For every destination Terminal a reverse shortest-path search finds, for each lane ending at an Intersection, which of
+// its exits leads to the destination most cheaply; the answer is written into that Intersection's next-hop table. The
+// searches for different destinations are independent and run in parallel.
+//
+// Cars therefore carry only a destination id and never a path, and routing a car in the tick is one array lookup.
+class Router {
+public:
+	static constexpr double UNREACHABLE = 1e300;
+private:
+	struct Link {
+		Lane* lane;
+		Intersection* intersection;
+		int terminal;
+		double cost;
+		std::vector<int> successors;
+		std::vector<int> predecessors;
+	};
+
+	struct CostChange {
+		int link;
+		double oldCost;
+	};
+
+	std::vector<Link> _links;
+	int _destinationCount = 0;
+	// Both indexed [destination * link count + link].
+	std::vector<double> _distance;
+	std::vector<uint8_t> _nextExit;
+	std::vector<CostChange> _pendingChanges;
+
+	size_t cell(int destination, int link) const { return static_cast<size_t>(destination) * _links.size() + link; }
+	void computeDestination(int destination);
+	bool isAffected(int destination, const CostChange& change) const;
+	void computeDestinations(const std::vector<int>& destinations);
+public:
+	// Lane ids must be their index in `lanes`; Terminal ids are the destination numbers.
+	void build(const std::vector<Lane*>& lanes);
+	int getDestinationCount() const { return _destinationCount; }
+
+	double getLinkCost(const Lane* lane) const;
+	// Takes effect at the next refresh().
+	void setLinkCost(const Lane* lane, double cost);
+	// Recomputes only the destinations whose routes the pending cost changes can alter. Returns how many were recomputed.
+	int refresh();
+
+	double getDistance(const Lane* lane, int destination) const;
+	std::vector<int> getReachableDestinations(const Lane* lane) const;
+};
\ No newline at end of file
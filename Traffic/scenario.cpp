@@ -0,0 +1,273 @@
+#include "scenario.h"
+
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+Scenario Scenario::createCross() {
+	Scenario scenario;
+
+	// Node 0 is the intersection; origins and terminals sit at the far end of each street. Screen coordinates, so
+	// negative y is up.
+	scenario.nodes.resize(9);
+	scenario.nodes[0] = { IntersectionNode, 0, 0 };
+	scenario.nodes[1] = { OriginNode, 0, -50 };   // A, top
+	scenario.nodes[2] = { OriginNode, -50, 0 };   // B, left
+	scenario.nodes[3] = { OriginNode, 0, 50 };    // C, bottom
+	scenario.nodes[4] = { OriginNode, 50, 0 };    // D, right
+	scenario.nodes[5] = { TerminalNode, 0, 50 };  // E, bottom
+	scenario.nodes[6] = { TerminalNode, 50, 0 };  // F, right
+	scenario.nodes[7] = { TerminalNode, 0, -50 }; // G, top
+	scenario.nodes[8] = { TerminalNode, -50, 0 }; // H, left
+
+	// Lanes A-D head into the intersection (south, east, north, west); E-H head out of it.
+	enum { A, B, C, D, E, F, G, H };
+	scenario.lanes = {
+		{ 1, 0, 50 }, { 2, 0, 50 }, { 3, 0, 50 }, { 4, 0, 50 },
+		{ 0, 5, 50 }, { 0, 6, 50 }, { 0, 7, 50 }, { 0, 8, 50 },
+	};
+
+	// Straight through first, then left and right turns.
+	scenario.turns = {
+		{ A, E }, { A, F }, { A, H },
+		{ B, F }, { B, G }, { B, E },
+		{ C, G }, { C, H }, { C, F },
+		{ D, H }, { D, E }, { D, G },
+	};
+
+	// Clockwise from the top-left corner of the box, as laid out by the Renderer.
+	scenario.boundaries.push_back({ 0, { A, G, D, F, C, E, B, H } });
+
+	// East-west traffic starts on green; each street gets Green 16 ticks, Yellow 4, then Red while the other runs.
+	Plan plan;
+	plan.node = 0;
+	plan.phases.push_back({ { B, D }, 16, 4, 0 });
+	plan.phases.push_back({ { A, C }, 16, 4, 0 });
+	scenario.plans.push_back(plan);
+
+	return scenario;
+}
+
+namespace {
+	[[noreturn]] void fail(int lineNumber, const std::string& message) {
+		throw std::runtime_error("Scenario line " + std::to_string(lineNumber) + ": " + message);
+	}
+
+	template <typename T>
+	void growTo(std::vector<T>& items, int id, int lineNumber) {
+		if (id < 0) {
+			fail(lineNumber, "negative id");
+		}
+		if (id >= static_cast<int>(items.size())) {
+			items.resize(id + 1);
+		}
+	}
+}
+
+Scenario Scenario::read(std::istream& in) {
+	Scenario scenario;
+	std::vector<bool> hasNode;
+	std::vector<bool> hasLane;
+	std::string line;
+	int lineNumber = 0;
+
+	auto planFor = [&scenario](int node) -> Plan& {
+		auto found = std::find_if(scenario.plans.begin(), scenario.plans.end(), [node](const Plan& plan) { return plan.node == node; });
+		if (found != scenario.plans.end()) {
+			return *found;
+		}
+		scenario.plans.push_back(Plan());
+		scenario.plans.back().node = node;
+		return scenario.plans.back();
+	};
+
+	while (std::getline(in, line)) {
+		lineNumber++;
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream fields(line);
+		std::string keyword;
+		if (!(fields >> keyword)) {
+			continue;
+		}
+
+		if (keyword == "node") {
+			int id = -1;
+			std::string kind;
+			Node node;
+			if (!(fields >> id >> kind >> node.x >> node.y)) {
+				fail(lineNumber, "expected: node <id> <kind> <x> <y>");
+			}
+			if (kind == "origin") {
+				node.kind = OriginNode;
+			}
+			else if (kind == "intersection") {
+				node.kind = IntersectionNode;
+			}
+			else if (kind == "terminal") {
+				node.kind = TerminalNode;
+			}
+			else {
+				fail(lineNumber, "unknown node kind '" + kind + "'");
+			}
+			growTo(scenario.nodes, id, lineNumber);
+			growTo(hasNode, id, lineNumber);
+			// Demand and fleet lines may come first.
+			node.demandPercent = scenario.nodes[id].demandPercent;
+			node.busPercent = scenario.nodes[id].busPercent;
+			node.truckPercent = scenario.nodes[id].truckPercent;
+			scenario.nodes[id] = node;
+			hasNode[id] = true;
+		}
+		else if (keyword == "lane") {
+			int id = -1;
+			Lane lane;
+			if (!(fields >> id >> lane.from >> lane.to >> lane.length)) {
+				fail(lineNumber, "expected: lane <id> <from> <to> <length> [micro|meso]");
+			}
+			std::string model;
+			if (fields >> model) {
+				if (model != "micro" && model != "meso") {
+					fail(lineNumber, "unknown lane model '" + model + "'");
+				}
+				lane.isMesoscopic = model == "meso";
+			}
+			if (lane.length <= 0) {
+				fail(lineNumber, "lane length must be positive");
+			}
+			growTo(scenario.lanes, id, lineNumber);
+			growTo(hasLane, id, lineNumber);
+			scenario.lanes[id] = lane;
+			hasLane[id] = true;
+		}
+		else if (keyword == "turn") {
+			Turn turn {};
+			if (!(fields >> turn.fromLane >> turn.toLane)) {
+				fail(lineNumber, "expected: turn <from lane> <to lane>");
+			}
+			scenario.turns.push_back(turn);
+		}
+		else if (keyword == "boundary") {
+			Boundary boundary;
+			if (!(fields >> boundary.node)) {
+				fail(lineNumber, "expected: boundary <node> <lane> ...");
+			}
+			for (int lane; fields >> lane;) {
+				boundary.lanes.push_back(lane);
+			}
+			scenario.boundaries.push_back(boundary);
+		}
+		else if (keyword == "road") {
+			Road road;
+			for (int lane; fields >> lane;) {
+				road.lanes.push_back(lane);
+			}
+			if (road.lanes.size() < 2) {
+				fail(lineNumber, "expected: road <lane> <lane> ...");
+			}
+			scenario.roads.push_back(road);
+		}
+		else if (keyword == "plan") {
+			int node = -1;
+			int offset = 0;
+			if (!(fields >> node >> offset)) {
+				fail(lineNumber, "expected: plan <node> <offset>");
+			}
+			planFor(node).offsetTicks = offset;
+		}
+		else if (keyword == "phase") {
+			int node = -1;
+			Phase phase;
+			if (!(fields >> node >> phase.greenTicks >> phase.yellowTicks >> phase.allRedTicks)) {
+				fail(lineNumber, "expected: phase <node> <green> <yellow> <all red> <lane> ... [max <green>]");
+			}
+			for (int lane; fields >> lane;) {
+				phase.lanes.push_back(lane);
+			}
+			if (!fields.eof()) {
+				fields.clear();
+				std::string max;
+				if (!(fields >> max >> phase.maxGreenTicks) || max != "max") {
+					fail(lineNumber, "expected: phase <node> <green> <yellow> <all red> <lane> ... [max <green>]");
+				}
+			}
+			planFor(node).phases.push_back(phase);
+		}
+		else if (keyword == "control") {
+			int node = -1;
+			std::string control;
+			int ticks = 0;
+			if (!(fields >> node >> control >> ticks) || (control != "gap" && control != "queue") || ticks <= 0) {
+				fail(lineNumber, "expected: control <node> gap|queue <ticks>");
+			}
+			Plan& plan = planFor(node);
+			plan.control = control == "gap" ? GapOut : QueueLength;
+			plan.controlTicks = ticks;
+		}
+		else if (keyword == "detector") {
+			Detector detector;
+			if (!(fields >> detector.lane >> detector.position >> detector.length)) {
+				fail(lineNumber, "expected: detector <lane> <position> <length>");
+			}
+			scenario.detectors.push_back(detector);
+		}
+		else if (keyword == "demand") {
+			int node = -1;
+			int percent = 0;
+			if (!(fields >> node >> percent) || percent < 0 || percent > 100) {
+				fail(lineNumber, "expected: demand <origin node> <percent 0-100>");
+			}
+			growTo(scenario.nodes, node, lineNumber);
+			growTo(hasNode, node, lineNumber);
+			scenario.nodes[node].demandPercent = percent;
+		}
+		else if (keyword == "fleet") {
+			int node = -1;
+			int buses = 0;
+			int trucks = 0;
+			if (!(fields >> node >> buses >> trucks) || buses < 0 || trucks < 0 || buses + trucks > 100) {
+				fail(lineNumber, "expected: fleet <origin node> <bus percent> <truck percent>, adding up to at most 100");
+			}
+			growTo(scenario.nodes, node, lineNumber);
+			growTo(hasNode, node, lineNumber);
+			scenario.nodes[node].busPercent = buses;
+			scenario.nodes[node].truckPercent = trucks;
+		}
+		else {
+			fail(lineNumber, "unknown keyword '" + keyword + "'");
+		}
+	}
+
+	if (std::find(hasNode.begin(), hasNode.end(), false) != hasNode.end()) {
+		throw std::runtime_error("Scenario node ids are not contiguous");
+	}
+	if (std::find(hasLane.begin(), hasLane.end(), false) != hasLane.end()) {
+		throw std::runtime_error("Scenario lane ids are not contiguous");
+	}
+
+	int nodeCount = static_cast<int>(scenario.nodes.size());
+	for (const Lane& lane : scenario.lanes) {
+		if (lane.from < 0 || lane.from >= nodeCount || lane.to < 0 || lane.to >= nodeCount) {
+			throw std::runtime_error("Scenario lane refers to a missing node");
+		}
+	}
+	for (const Detector& detector : scenario.detectors) {
+		if (detector.lane < 0 || detector.lane >= static_cast<int>(scenario.lanes.size())) {
+			throw std::runtime_error("Scenario detector refers to a missing lane");
+		}
+	}
+
+	return scenario;
+}
+
+Scenario Scenario::load(const std::string& path) {
+	std::ifstream in(path);
+	if (!in.is_open()) {
+		throw std::runtime_error("Failed to open scenario " + path);
+	}
+	return read(in);
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+#include <istream>
+#include <string>
+#include <vector>
+
+// Description of a road network and its demand, from which a Simulation builds its nodes and lanes.
+//
+// Scenarios are stored as line-oriented text so that generated networks can be streamed straight to disk. Lines may
+// appear in any order; '#' starts a comment. Node and lane ids must together cover 0..n-1.
+//
+//   node <id> origin|intersection|terminal <x> <y>
+//   lane <id> <from node> <to node> <length> [micro|meso]
+//   turn <from lane> <to lane>                    movement through the intersection the lanes share
+//   boundary <node> <lane> <lane> ...             lane ends around the intersection box, clockwise
+//   road <lane> <lane> ...                        parallel lanes between the same nodes, drivers' left to right
+//   plan <node> <offset>                          fixed-time signal plan for an intersection...
+//   phase <node> <green> <yellow> <all red> <lane> ... [max <green>]   ...and its phases, in order
+//   control <node> gap|queue <ticks>              makes the plan actuated: gap-out after <ticks> without a detection,
+//                                                 or a green of <ticks> per queued car (see SignalPlan)
+//   detector <lane> <position> <length>           loop detector over cells position..position + length - 1
+//   demand <origin node> <percent per tick>
+//   fleet <origin node> <bus percent> <truck percent>   share of departures that are buses and trucks (see VehicleClass)
+struct Scenario {
+	enum NodeKind { OriginNode, IntersectionNode, TerminalNode };
+	enum Control { FixedTime, GapOut, QueueLength };
+
+	struct Node {
+		NodeKind kind = IntersectionNode;
+		double x = 0.0;
+		double y = 0.0;
+		int demandPercent = 20;
+		int busPercent = 0;
+		int truckPercent = 0;
+	};
+
+	struct Lane {
+		int from = -1;
+		int to = -1;
+		int length = 0;
+		bool isMesoscopic = false;
+	};
+
+	struct Turn {
+		int fromLane;
+		int toLane;
+	};
+
+	struct Phase {
+		std::vector<int> lanes;
+		int greenTicks = 0;
+		int yellowTicks = 0;
+		int allRedTicks = 0;
+		int maxGreenTicks = 0;
+	};
+
+	struct Plan {
+		int node = -1;
+		int offsetTicks = 0;
+		std::vector<Phase> phases;
+		Control control = FixedTime;
+		int controlTicks = 0;
+	};
+
+	struct Detector {
+		int lane = -1;
+		int position = 0;
+		int length = 0;
+	};
+
+	struct Boundary {
+		int node = -1;
+		std::vector<int> lanes;
+	};
+
+	struct Road {
+		std::vector<int> lanes;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Lane> lanes;
+	std::vector<Turn> turns;
+	std::vector<Plan> plans;
+	std::vector<Boundary> boundaries;
+	std::vector<Road> roads;
+	std::vector<Detector> detectors;
+
+	// The original demo: one intersection at the centre of four two-way streets, with every turn allowed.
+	static Scenario createCross();
+
+	// Throws std::runtime_error describing the offending line if the input is malformed.
+	static Scenario read(std::istream& in);
+	static Scenario load(const std::string& path);
+};
\ No newline at end of file
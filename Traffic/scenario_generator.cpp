@@ -0,0 +1,330 @@
+#include "scenario_generator.h"
+#include "simulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+	// Step to the neighbouring intersection on each side: top, right, bottom, left.
+	const int ROW_STEP[] = { -1, 0, 1, 0 };
+	const int COLUMN_STEP[] = { 0, 1, 0, -1 };
+}
+
+ScenarioGenerator::ScenarioGenerator(const Options& options) : _options(options) {
+	if (options.rows < 1 || options.columns < 1) {
+		throw std::invalid_argument("A generated grid needs at least one row and one column");
+	}
+	if (options.laneLength < Car::getCruiseSpeed()) {
+		throw std::invalid_argument("Generated lanes must be at least one step long");
+	}
+	if (options.greenTicks + options.yellowTicks + options.allRedTicks <= 0) {
+		throw std::invalid_argument("Generated signal phases must last at least one tick");
+	}
+	if (options.control != Scenario::FixedTime && (options.gapTicks <= 0 || options.headwayTicks <= 0)) {
+		throw std::invalid_argument("Actuated signals need a positive gap and headway");
+	}
+	if (options.busPercent < 0 || options.truckPercent < 0 || options.busPercent + options.truckPercent > 100) {
+		throw std::invalid_argument("Bus and truck percentages must be non-negative and add up to at most 100");
+	}
+	// Each side's lanes share straight-on movements between them, plus a left turn from the leftmost and a right turn
+	// from the rightmost.
+	if (options.lanesPerStreet < 1 || 4 * (options.lanesPerStreet + 2) > Intersection::MAX_MOVEMENTS) {
+		throw std::invalid_argument("Too many lanes per street for one intersection's movements");
+	}
+
+	_freeFlowTicks = options.laneLength / Car::getCruiseSpeed() + 1;
+
+	// Lanes are numbered by the intersection they arrive at, so each one needs the count of all arriving lanes before it.
+	_firstLane.resize(static_cast<size_t>(options.rows) * options.columns);
+	int64_t next = 0;
+	for (int row = 0; row < options.rows; row++) {
+		for (int column = 0; column < options.columns; column++) {
+			_firstLane[intersectionNode(row, column)] = next;
+			for (int side = Top; side <= Left; side++) {
+				if (hasSide(row, column, side)) {
+					next += options.lanesPerStreet;
+				}
+			}
+		}
+	}
+	_boundaryLaneStart = next;
+}
+
+uint64_t ScenarioGenerator::hash(uint64_t seed, uint64_t a, uint64_t b) {
+	// splitmix64 finalizer over the combined key.
+	uint64_t z = seed ^ (a * 0x9E3779B97F4A7C15ull) ^ (b * 0xC2B2AE3D27D4EB4Full);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+bool ScenarioGenerator::hasStreet(int row, int column, int side) const {
+	// The street east of (row, column) is removed when its hash falls under the drop fraction.
+	auto isEastStreetKept = [this](int r, int c) {
+		if (!_options.isPlanar) {
+			return true;
+		}
+		double draw = static_cast<double>(hash(_options.seed, intersectionNode(r, c), 1) >> 11) * 0x1.0p-53;
+		return draw >= _options.dropFraction;
+	};
+
+	switch (side) {
+	case Top:
+		return row > 0;
+	case Bottom:
+		return row < _options.rows - 1;
+	case Right:
+		return column < _options.columns - 1 && isEastStreetKept(row, column);
+	case Left:
+		return column > 0 && isEastStreetKept(row, column - 1);
+	}
+	return false;
+}
+
+bool ScenarioGenerator::isBoundary(int row, int column, int side) const {
+	switch (side) {
+	case Top:
+		return row == 0;
+	case Bottom:
+		return row == _options.rows - 1;
+	case Right:
+		return column == _options.columns - 1;
+	case Left:
+		return column == 0;
+	}
+	return false;
+}
+
+int64_t ScenarioGenerator::boundaryIndex(int row, int column, int side) const {
+	// Top edge, right edge, bottom edge, left edge.
+	int64_t rows = _options.rows;
+	int64_t columns = _options.columns;
+	switch (side) {
+	case Top:
+		return column;
+	case Right:
+		return columns + row;
+	case Bottom:
+		return columns + rows + column;
+	default:
+		return 2 * columns + rows + row;
+	}
+}
+
+int64_t ScenarioGenerator::incomingLane(int row, int column, int side, int lane) const {
+	int64_t first = _firstLane[intersectionNode(row, column)];
+	for (int before = Top; before < side; before++) {
+		if (hasSide(row, column, before)) {
+			first += _options.lanesPerStreet;
+		}
+	}
+	return first + lane;
+}
+
+int64_t ScenarioGenerator::outgoingLane(int row, int column, int side, int lane) const {
+	if (isBoundary(row, column, side)) {
+		return _boundaryLaneStart + boundaryIndex(row, column, side) * _options.lanesPerStreet + lane;
+	}
+	if (hasStreet(row, column, side)) {
+		return incomingLane(row + ROW_STEP[side], column + COLUMN_STEP[side], (side + 2) % 4, lane);
+	}
+	return -1;
+}
+
+void ScenarioGenerator::position(int row, int column, double& x, double& y) const {
+	double spacing = _options.laneLength;
+	x = column * spacing;
+	y = row * spacing;
+
+	if (_options.isPlanar) {
+		// Up to a quarter of the spacing either way, so streets never cross.
+		uint64_t node = intersectionNode(row, column);
+		x += (static_cast<double>(hash(_options.seed, node, 2) >> 11) * 0x1.0p-53 - 0.5) * spacing / 2;
+		y += (static_cast<double>(hash(_options.seed, node, 3) >> 11) * 0x1.0p-53 - 0.5) * spacing / 2;
+	}
+}
+
+int64_t ScenarioGenerator::getLaneCount() const {
+	return _boundaryLaneStart + 2 * (static_cast<int64_t>(_options.rows) + _options.columns) * _options.lanesPerStreet;
+}
+
+void ScenarioGenerator::writeRow(std::ostream& out, int row) const {
+	const char* model = _options.isMesoscopic ? " meso" : "";
+	int64_t firstBoundaryNode = static_cast<int64_t>(_options.rows) * _options.columns;
+	int phaseTicks = _options.greenTicks + _options.yellowTicks + _options.allRedTicks;
+	int lanes = _options.lanesPerStreet;
+
+	// Gap-out needs only to see cars reach the stop line; queue sizing needs to see the queue behind it.
+	auto writeDetector = [this, &out](int64_t lane, int length) {
+		if (_options.control == Scenario::FixedTime) {
+			return;
+		}
+		int cells = _options.control == Scenario::QueueLength ? std::min(length + 1, 20) : MAX_VEHICLE_SPEED;
+		out << "detector " << lane << " " << length + 1 - cells << " " << cells << "\n";
+	};
+
+	auto laneLength = [this](double x1, double y1, double x2, double y2) {
+		if (!_options.isPlanar) {
+			return _options.laneLength;
+		}
+		return std::max(Car::getCruiseSpeed(), static_cast<int>(std::lround(std::hypot(x2 - x1, y2 - y1))));
+	};
+
+	// Lane 0 of a street is the drivers' leftmost.
+	auto writeRoad = [&out, lanes](int64_t firstLane) {
+		if (lanes > 1) {
+			out << "road";
+			for (int lane = 0; lane < lanes; lane++) {
+				out << " " << firstLane + lane;
+			}
+			out << "\n";
+		}
+	};
+
+	for (int column = 0; column < _options.columns; column++) {
+		int64_t node = intersectionNode(row, column);
+		double x = 0;
+		double y = 0;
+		position(row, column, x, y);
+		out << "node " << node << " intersection " << x << " " << y << "\n";
+
+		for (int side = Top; side <= Left; side++) {
+			if (isBoundary(row, column, side)) {
+				int64_t origin = firstBoundaryNode + 2 * boundaryIndex(row, column, side);
+				double edgeX = x + COLUMN_STEP[side] * _options.laneLength;
+				double edgeY = y + ROW_STEP[side] * _options.laneLength;
+				int length = laneLength(x, y, edgeX, edgeY);
+				out << "node " << origin << " origin " << edgeX << " " << edgeY << "\n"
+					<< "node " << origin + 1 << " terminal " << edgeX << " " << edgeY << "\n"
+					<< "demand " << origin << " " << _options.demandPercent << "\n";
+				if (_options.busPercent > 0 || _options.truckPercent > 0) {
+					out << "fleet " << origin << " " << _options.busPercent << " " << _options.truckPercent << "\n";
+				}
+				for (int lane = 0; lane < lanes; lane++) {
+					out << "lane " << incomingLane(row, column, side, lane) << " " << origin << " " << node << " " << length << model << "\n"
+						<< "lane " << outgoingLane(row, column, side, lane) << " " << node << " " << origin + 1 << " " << length << model << "\n";
+					writeDetector(incomingLane(row, column, side, lane), length);
+				}
+				writeRoad(outgoingLane(row, column, side, 0));
+			}
+			else if (hasStreet(row, column, side)) {
+				int neighborRow = row + ROW_STEP[side];
+				int neighborColumn = column + COLUMN_STEP[side];
+				double neighborX = 0;
+				double neighborY = 0;
+				position(neighborRow, neighborColumn, neighborX, neighborY);
+				int length = laneLength(neighborX, neighborY, x, y);
+				for (int lane = 0; lane < lanes; lane++) {
+					out << "lane " << incomingLane(row, column, side, lane) << " " << intersectionNode(neighborRow, neighborColumn) << " " << node << " "
+						<< length << model << "\n";
+					writeDetector(incomingLane(row, column, side, lane), length);
+				}
+			}
+			else {
+				continue;
+			}
+			writeRoad(incomingLane(row, column, side, 0));
+		}
+
+		// Every lane may go straight on into the same lane of the next street; the leftmost may also turn left into the
+		// leftmost lane of the cross street, and the rightmost right into its rightmost. Where a planar grid dropped the
+		// street straight on, each other lane takes the turn of the nearer outer lane, or the other turn if that street is
+		// missing too, so no lane is left without an exit.
+		for (int from = Top; from <= Left; from++) {
+			if (!hasSide(row, column, from)) {
+				continue;
+			}
+			for (int lane = 0; lane < lanes; lane++) {
+				int64_t incoming = incomingLane(row, column, from, lane);
+				int64_t straight = outgoingLane(row, column, (from + 2) % 4, lane);
+				int64_t left = lane == 0 ? outgoingLane(row, column, (from + 1) % 4, 0) : -1;
+				int64_t right = lane == lanes - 1 ? outgoingLane(row, column, (from + 3) % 4, lanes - 1) : -1;
+				if (straight < 0 && left < 0 && right < 0) {
+					int64_t crossLeft = outgoingLane(row, column, (from + 1) % 4, 0);
+					int64_t crossRight = outgoingLane(row, column, (from + 3) % 4, lanes - 1);
+					if (crossRight < 0 || (crossLeft >= 0 && 2 * lane < lanes - 1)) {
+						left = crossLeft;
+					}
+					else {
+						right = crossRight;
+					}
+				}
+				for (int64_t exit : { straight, left, right }) {
+					if (exit >= 0) {
+						out << "turn " << incoming << " " << exit << "\n";
+					}
+				}
+			}
+		}
+
+		// Clockwise, each side's arriving lanes run from the drivers' right to their left, then the leaving lanes from
+		// left to right.
+		out << "boundary " << node;
+		for (int side = Top; side <= Left; side++) {
+			if (!hasSide(row, column, side)) {
+				continue;
+			}
+			for (int lane = lanes - 1; lane >= 0; lane--) {
+				out << " " << incomingLane(row, column, side, lane);
+			}
+			for (int lane = 0; lane < lanes; lane++) {
+				out << " " << outgoingLane(row, column, side, lane);
+			}
+		}
+		out << "\n";
+
+		// East-west first, offset by the eastbound travel time from the west edge.
+		out << "plan " << node << " " << (static_cast<int64_t>(column) * _freeFlowTicks) % (2 * phaseTicks) << "\n";
+		for (int axis : { Right, Top }) {
+			if (!hasSide(row, column, axis) && !hasSide(row, column, axis + 2)) {
+				continue;
+			}
+			out << "phase " << node << " " << _options.greenTicks << " " << _options.yellowTicks << " " << _options.allRedTicks;
+			for (int side : { axis, axis + 2 }) {
+				for (int lane = 0; lane < lanes && hasSide(row, column, side); lane++) {
+					out << " " << incomingLane(row, column, side, lane);
+				}
+			}
+			if (_options.control != Scenario::FixedTime) {
+				out << " max " << _options.maxGreenTicks;
+			}
+			out << "\n";
+		}
+		if (_options.control != Scenario::FixedTime) {
+			out << "control " << node << (_options.control == Scenario::GapOut ? " gap " : " queue ")
+				<< (_options.control == Scenario::GapOut ? _options.gapTicks : _options.headwayTicks) << "\n";
+		}
+	}
+}
+
+void ScenarioGenerator::write(std::ostream& out) const {
+	out << "# " << (_options.isPlanar ? "planar" : "grid") << " " << _options.rows << "x" << _options.columns
+		<< ", seed " << _options.seed << ", " << getLaneCount() << " lanes\n";
+
+	// Keep a bounded number of rows in flight and write them in order as they complete.
+	size_t window = 2 * std::max(1u, std::thread::hardware_concurrency());
+	std::deque<std::future<std::string>> pending;
+	int next = 0;
+	while (next < _options.rows || !pending.empty()) {
+		while (next < _options.rows && pending.size() < window) {
+			pending.push_back(std::async(std::launch::async, [this, row = next]() {
+				std::ostringstream chunk;
+				writeRow(chunk, row);
+				return chunk.str();
+				}));
+			next++;
+		}
+
+		out << pending.front().get();
+		pending.pop_front();
+	}
+}
\ No newline at end of file
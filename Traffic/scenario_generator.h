@@ -0,0 +1,72 @@
+#pragma once
+#include "scenario.h"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Writes synthetic networks in the Scenario text format, for scaling studies.
+//
+// A grid is rows x columns intersections joined by two-way streets of laneLength cells, with an origin/terminal pair at
+// the end of every street that leaves the grid. Streets may have several lanes each way, with left turns made from the
+// leftmost lane and right turns from the rightmost. Each intersection runs a two-phase plan (east-west, then
+// north-south) whose offset gives eastbound traffic a green wave along each row. The plans may instead be actuated, with
+// a detector at the stop line of every arriving lane (for gap-out) or over its last stretch (for queue-sized greens).
+//
+// The planar variant jitters the intersection positions, sizes each lane to the distance it covers, and removes some
+// east-west streets, leaving an irregular but still planar network. North-south streets are kept so that no
+// intersection is cut off.
+//
+// Output depends only on the options: every random choice is a hash of the seed and the element it decides, so any
+// row can be generated without the others. Rows are generated in parallel and streamed to the output in order, so
+// memory use stays bounded however large the grid.
+class ScenarioGenerator {
+public:
+	struct Options {
+		int rows = 1;
+		int columns = 1;
+		int laneLength = 50;
+		// Parallel lanes in each direction of every street, joined into a road that cars change lanes on.
+		int lanesPerStreet = 1;
+		int greenTicks = 16;
+		int yellowTicks = 4;
+		int allRedTicks = 0;
+		// Actuated control: greenTicks becomes the minimum green, extended up to maxGreenTicks.
+		Scenario::Control control = Scenario::FixedTime;
+		int maxGreenTicks = 40;
+		int gapTicks = 3;
+		int headwayTicks = 2;
+		int demandPercent = 20;
+		// Shares of departures that are buses and trucks.
+		int busPercent = 0;
+		int truckPercent = 0;
+		bool isMesoscopic = false;
+		bool isPlanar = false;
+		// Planar only: the fraction of east-west streets removed.
+		double dropFraction = 0.25;
+		uint64_t seed = 1;
+	};
+private:
+	enum Side { Top, Right, Bottom, Left };
+
+	Options _options;
+	int _freeFlowTicks;
+	// Id of the first lane arriving at each intersection; lanes leaving the grid follow all of those.
+	std::vector<int64_t> _firstLane;
+	int64_t _boundaryLaneStart = 0;
+
+	static uint64_t hash(uint64_t seed, uint64_t a, uint64_t b);
+	bool hasStreet(int row, int column, int side) const;
+	bool isBoundary(int row, int column, int side) const;
+	bool hasSide(int row, int column, int side) const { return hasStreet(row, column, side) || isBoundary(row, column, side); }
+	int64_t intersectionNode(int row, int column) const { return static_cast<int64_t>(row) * _options.columns + column; }
+	int64_t boundaryIndex(int row, int column, int side) const;
+	int64_t incomingLane(int row, int column, int side, int lane) const;
+	int64_t outgoingLane(int row, int column, int side, int lane) const;
+	void position(int row, int column, double& x, double& y) const;
+	void writeRow(std::ostream& out, int row) const;
+public:
+	explicit ScenarioGenerator(const Options& options);
+	int64_t getLaneCount() const;
+	void write(std::ostream& out) const;
+};
\ No newline at end of file
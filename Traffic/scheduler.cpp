@@ -0,0 +1,135 @@
+#include "scheduler.h"
+
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+namespace {
+	// True for the key presses _kbhit() reports and _getch() reads: characters, and the navigation and function keys
+	// _getch() returns as two-byte sequences. Modifier and lock keys on their own, such as the Alt of Alt-Tab, are not.
+	bool isReadableKey(const KEY_EVENT_RECORD& key) {
+		if (!key.bKeyDown) {
+			return false;
+		}
+		if (key.uChar.AsciiChar != 0) {
+			return true;
+		}
+		WORD code = key.wVirtualKeyCode;
+		return (code >= VK_PRIOR && code <= VK_DOWN) || code == VK_INSERT || code == VK_DELETE || (code >= VK_F1 && code <= VK_F12);
+	}
+}
+#endif
+
+int Scheduler::every(Clock::duration period, Task task) {
+	if (period <= Clock::duration::zero()) {
+		throw std::invalid_argument("Scheduler period must be positive");
+	}
+
+	int timer = static_cast<int>(_timers.size());
+	_timers.push_back({ period, std::move(task), true });
+	_deadlines.push({ Clock::now() + period, _sequence++, timer });
+	return timer;
+}
+
+void Scheduler::cancel(int timer) {
+	// The stale deadline is dropped when it reaches the front of the queue.
+	_timers.at(timer).isActive = false;
+}
+
+int Scheduler::runDue(Clock::time_point now) {
+	int ran = 0;
+
+	while (!_deadlines.empty() && _deadlines.top().when <= now) {
+		Deadline due = _deadlines.top();
+		_deadlines.pop();
+
+		Timer& timer = _timers[due.timer];
+		if (!timer.isActive) {
+			continue;
+		}
+
+		// Advance along the original grid. If we have fallen more than a period behind, skip the missed slots rather
+		// than running the task back-to-back to catch up.
+		Clock::time_point next = due.when + timer.period;
+		if (next <= now) {
+			next += ((now - next) / timer.period + 1) * timer.period;
+		}
+		_deadlines.push({ next, _sequence++, due.timer });
+
+		timer.task();
+		ran++;
+	}
+
+	return ran;
+}
+
+void Scheduler::run() {
+	_isRunning = true;
+
+	while (_isRunning) {
+		Clock::time_point wakeAt = _deadlines.empty() ? Clock::time_point::max() : _deadlines.top().when;
+
+		if (waitForInput(wakeAt)) {
+			if (_inputHandler) {
+				_inputHandler();
+			}
+			continue;
+		}
+
+		runDue(Clock::now());
+	}
+}
+
+bool Scheduler::waitForInput(Clock::time_point deadline) {
+	Clock::time_point now = Clock::now();
+	if (deadline <= now) {
+		return false;
+	}
+
+	// Round up so we never wake just before the deadline and spin.
+	auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+	long long timeoutMs = deadline == Clock::time_point::max() ? -1 : remaining.count();
+
+#ifdef _WIN32
+	HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+	while (true) {
+		DWORD result = WaitForSingleObject(input, timeoutMs < 0 ? INFINITE : static_cast<DWORD>(timeoutMs));
+		if (result != WAIT_OBJECT_0) {
+			return false;
+		}
+
+		// The console handle is also signalled by focus, mouse and resize events, key releases and modifier keys. Only
+		// keys the input handler can read count as input; the records in front of the first one are consumed one by one
+		// so the handle does not stay signalled and spin us, while that key and anything queued behind it stay for the
+		// input handler.
+		INPUT_RECORD record;
+		DWORD count = 0;
+		while (PeekConsoleInputA(input, &record, 1, &count) && count == 1) {
+			if (record.EventType == KEY_EVENT && isReadableKey(record.Event.KeyEvent)) {
+				return true;
+			}
+			ReadConsoleInputA(input, &record, 1, &count);
+		}
+
+		now = Clock::now();
+		if (deadline <= now) {
+			return false;
+		}
+		if (timeoutMs >= 0) {
+			timeoutMs = std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+		}
+	}
+#else
+	pollfd input { STDIN_FILENO, POLLIN, 0 };
+	int result = poll(&input, 1, timeoutMs < 0 ? -1 : static_cast<int>(timeoutMs));
+	return result > 0 && (input.revents & (POLLIN | POLLHUP)) != 0;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+// Single-threaded cooperative scheduler. Repeating timers are kept in a queue ordered by monotonic deadline; each
+// timer's next deadline is its previous deadline plus its period, so pacing never drifts no matter how long a task
+// runs or how late the thread wakes. Between deadlines the thread blocks on standard input instead of sleeping or
+// spinning, so key presses are handled promptly and an idle simulation costs no CPU.
+class Scheduler {
+public:
+	using Clock = std::chrono::steady_clock;
+	using Task = std::function<void()>;
+private:
+	struct Timer {
+		Clock::duration period;
+		Task task;
+		bool isActive;
+	};
+
+	struct Deadline {
+		Clock::time_point when;
+		uint64_t sequence;
+		int timer;
+		bool operator>(const Deadline& other) const {
+			return when != other.when ? when > other.when : sequence > other.sequence;
+		}
+	};
+
+	std::vector<Timer> _timers;
+	std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> _deadlines;
+	uint64_t _sequence = 0;
+	Task _inputHandler;
+	bool _isRunning = false;
+
+	// Blocks until input is available or the deadline passes. Returns true if input is available.
+	bool waitForInput(Clock::time_point deadline);
+public:
+	// Runs `task` every `period`, starting one period from now. Tasks scheduled with equal deadlines run in the order
+	// they were added.
+	int every(Clock::duration period, Task task);
+	void cancel(int timer);
+	void onInput(Task handler) { _inputHandler = std::move(handler); }
+
+	// Runs timers until stop() is called, typically from a task or the input handler.
+	void run();
+	// Runs every timer that is due, without blocking. Returns the number of tasks run.
+	int runDue(Clock::time_point now);
+	void stop() { _isRunning = false; }
+	bool isRunning() const { return _isRunning; }
+};
\ No newline at end of file
@@ -4,6 +4,9 @@
 
 #ifdef _WIN32
 #include <Windows.h>
+#else
+#include <sys/ioctl.h>
+#include <unistd.h>
 #endif
 
 void ScreenWriter::init() {
@@ -27,6 +30,24 @@ void ScreenWriter::clearScreen() {
 	std::cout << "\033[2J\033[1;1H\033[0m" << std::flush;
 }
 
+void ScreenWriter::getSize(int& columns, int& rows) {
+	columns = 80;
+	rows = 25;
+#ifdef _WIN32
+	CONSOLE_SCREEN_BUFFER_INFO info;
+	if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+		columns = info.srWindow.Right - info.srWindow.Left + 1;
+		rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+	}
+#else
+	winsize size {};
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0) {
+		columns = size.ws_col;
+		rows = size.ws_row;
+	}
+#endif
+}
+
 void ScreenWriter::put(int col, int row, const std::string& text, const std::string& color) {
 	std::cout << "\033[" << row << ";" << col << "H";
 	std::cout << color << text << std::flush;
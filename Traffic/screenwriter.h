@@ -12,5 +12,7 @@ public:
 
 	static void init();
 	static void clearScreen();
+	// Size of the console window in characters, or 80 x 25 if it cannot be found.
+	static void getSize(int& columns, int& rows);
 	static void put(int col, int row, const std::string& text, const std::string& color = "");
 };
\ No newline at end of file
@@ -1,104 +1,321 @@
 #include "simulation.h"
 
+#include "allocation_tracker.h"
+#include "demand.h"
+#include "event_log.h"
+#include "metrics.h"
 #include "notifications.h"
 #include "renderer.h"
+#include "road.h"
+#include "routing.h"
+#include "scenario.h"
+#include "scheduler.h"
 #include "screenwriter.h"
+#include "statistics.h"
 #include "traffic_nodes.h"
 
 #include <algorithm>
 #include <any>
-#include <array>
 #include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
 #include <fstream>
-#include <future>
 #include <iostream>
 #include <memory>
-#include <mutex>
 #include <ostream>
+#include <random>
+#include <stdexcept>
 #include <string>
-#include <thread>
 #include <utility>
 #include <vector>
 
 /// <summary>
 /// Simulation architecture:
 /// 
-/// This is a simulation of traffic moving through a single intersection. Important entities are as follows:
+/// This is a simulation of traffic moving through a network of intersections. Important entities are as follows:
 /// 
-/// Car - An object that travels along Lanes, beginning at an Origin and ending at a Terminal.
-/// Lane - A one-dimensional path along which Cars travel in a single direction.
+/// Car - An object that travels along Lanes, beginning at an Origin and ending at a Terminal. Each Car is a passenger car,
+///     bus or truck, with that class's acceleration, length and top speed (see vehicle_class.h).
+/// Lane - A one-dimensional path along which Cars travel in a single direction. A Lane is either microscopic (cars move
+///     cell by cell) or mesoscopic (a FIFO queue with a capacity and free-flow travel time), chosen per lane or per run.
+/// Road - Parallel microscopic Lanes between the same two nodes. Each tick, cars that are held up or on a lane that cannot
+///     reach their destination may change to an adjacent lane (see road.h).
 /// Exitable - Each Lane has an Exitable object at its beginning. This object is capable of emitting cars
 ///     into the lane.
 /// Enterable - Each Lane has an Enterable object at its end. This object is capable of accepting cars
 ///     from the lane.
 /// Origin - Inherits Exitable: it governs the generation of Cars for a given Lane.
 /// Intersection - Inherits Enterable and Exitable: it allows multiple Lanes to connect. It also contains the logic that
-///     governs when Cars can travel through the Intersection.
+///     governs when Cars can travel through the Intersection: each approach may have left, straight and right movements,
+///     and a precomputed conflict bitmask decides which movements may share the box.
 /// Terminal - Inherits Exitable: it represents a car's destination. It signals that cars should be deleted.
 /// 
-/// An Intersection contains a StopLight for each incoming lane that connects to it. It runs a single thread
-/// which sends out a pulse. The StopLights count these pulses to advance their own state (Green -> Yellow -> Red -> Green, etc.)
+/// Each Car is given a destination Terminal when it is created. A Router (see routing.h) precomputes, per destination,
+/// which exit every Intersection approach should take, so a car is routed with a single table lookup as it enters.
+/// 
+/// Microscopic cars move once per tick, front of each lane first. The movement kernel (Simulation::moveRun) is a template
+/// instantiated per vehicle class and applied to each run of same-class cars on a lane, so the class's parameters are
+/// constants in the loop rather than a load and a branch per car.
+/// 
+/// An Intersection controls a signal for each incoming lane that connects to it. Signals follow a fixed-time SignalPlan
+/// (phases with splits, a cycle length and an offset) precompiled into a phase table, and the current state is looked up
+/// from the tick number, so signals advance in lockstep with the tick and need no thread or timer of their own.
+/// An actuated plan steps through the same table but holds a phase's green while the loop detectors on its lanes
+/// (Lane::Detector, kept up to date as cars cross them) call for more: gap-out, max-out or a green sized to the queue.
+/// 
+/// The network is described by a Scenario (see scenario.h): the built-in four-street cross, a file written by hand, or a
+/// generated grid (see scenario_generator.h).
+/// 
+/// The Renderer (see renderer.h) draws a movable, zoomable viewport onto the network from a precomputed lane geometry table,
+/// visiting only the lanes a spatial index finds under the viewport. Zoomed out, it shows a density heatmap instead of cars.
 /// 
 /// The Simulation owns all Cars, Lanes, and Enterable/Exitables. Lanes and their components are long-lived; their lifespan is
 /// essentially the same as the Simulation's. Cars are ephemeral, and while Origins and Terminals are responsible for signalling
 /// the beginning and end of a Car's life, the Simulation is responsible for the actual creation and deletion of Cars.
 /// 
-/// A monitor thread was created for the purpose of testing the simulation. It detects collisions between cars in the same lane.
+/// Everything runs on one thread. A Scheduler (see scheduler.h) owns a queue of monotonic deadlines and drives the tick,
+/// rendering and the monitor; between deadlines it blocks on keyboard input. Because nothing runs concurrently, none of
+/// the simulation state needs a lock.
+/// 
+/// A monitor task was created for the purpose of testing the simulation. It detects collisions between cars in the same lane.
 /// This surfaced several bugs during development.
 /// 
+/// Collisions, lane exits, signal changes and car lifetimes are recorded in an EventLog (see event_log.h): each is a fixed-size
+/// binary record pushed into a per-thread ring, and a background thread writes the rings to events.bin, so logging never
+/// blocks the tick. `Traffic decode events.bin` prints the records as text.
+/// 
+/// Statistics are gathered in-tick by the simulation thread: lane exits, queued (stopped) cars, stops and completed trips
+/// are each a constant-time update to fixed-size counters and histograms. Closed time buckets are appended to statistics.csv.
+/// 
+/// Live counters (tick, ticks/sec, car count, lane occupancy, signal states) are published once per tick into a shared-memory
+/// segment guarded by a seqlock (see metrics.h), so external readers such as `Traffic metrics` never block the simulation.
+/// 
 /// 
 /// 
 /// </summary>
 
-const int Car::MIN_ACCEL_INTERVAL = 2;
-
 Car* Lane::findCarAt(int position) const {
+	auto found = std::partition_point(_cars.begin(), _cars.end(), [position](const Car* car) { return car->getPosition() > position; });
+	return found != _cars.end() && (*found)->getPosition() == position ? *found : nullptr;
+}
+
+bool Lane::isClear(int from, int to) const {
+	auto found = std::partition_point(_cars.begin(), _cars.end(), [to](const Car* car) { return car->getPosition() > to; });
+	return found == _cars.end() || (*found)->getPosition() < from;
+}
+
+size_t Lane::findCollision(size_t first) const {
+	for (size_t i = std::max<size_t>(first, 1); i < _cars.size(); i++) {
+		if (_cars[i]->getPosition() > _cars[i - 1]->getPosition() - _cars[i - 1]->getLength()) {
+			return i;
+		}
+	}
+	return _cars.size();
+}
+
+void Lane::removeFrontCar(Car* car) {
+	if (_cars.empty() || _cars.front() != car) {
+		throw std::logic_error("Only the car at the front can leave a lane");
+	}
+	_cars.erase(_cars.begin());
+	leaveDetectors(car->getPosition());
+	countCars(-1);
+}
+
+void Lane::exchangeCars(const std::vector<Car*>& arriving) {
+	int before = static_cast<int>(_cars.size());
+	_mergedCars.clear();
+	auto next = arriving.begin();
 	for (Car* car : _cars) {
-		if (car->getPosition() == position) {
-			return car;
+		if (car->getLane() != this) {
+			leaveDetectors(car->getPosition());
+			continue;
+		}
+		for (; next != arriving.end() && (*next)->getPosition() > car->getPosition(); ++next) {
+			_mergedCars.push_back(*next);
+			enterDetectors((*next)->getPosition());
 		}
+		_mergedCars.push_back(car);
+	}
+	for (; next != arriving.end(); ++next) {
+		_mergedCars.push_back(*next);
+		enterDetectors((*next)->getPosition());
+	}
+	_cars.swap(_mergedCars);
+	countCars(static_cast<int>(_cars.size()) - before);
+}
+
+void Lane::addCar(Car* car) {
+	if (_model == Microscopic) {
+		// Cars normally join at the entrance, behind everyone else, so this is an append.
+		int position = car->getPosition();
+		auto after = std::partition_point(_cars.begin(), _cars.end(), [position](const Car* other) { return other->getPosition() >= position; });
+		_cars.insert(after, car);
+		enterDetectors(position);
+		countCars(1);
+		return;
+	}
+
+	for (Detector& detector : _detectors) {
+		enterDetector(detector);
 	}
 
-	return nullptr;
+	// A slower car holds up the faster ones that join behind it, which also keeps ready ticks in queue order.
+	int capacity = getCapacity();
+	uint64_t readyTick = _tick + _freeFlowTicks[car->getVehicleClass()];
+	if (_queueCount > 0) {
+		readyTick = std::max(readyTick, _queue[(_queueHead + _queueCount - 1) % capacity].readyTick);
+	}
+	_queue[(_queueHead + _queueCount) % capacity] = { car, readyTick };
+	_queueCount++;
+	_lastEntryTick = _tick;
+	car->setLaneEntryTick(_tick);
+	countCars(1);
 }
 
-void Lane::removeCar(Car* car) {
-	std::erase(_cars, car);
+bool Lane::hasRoomAtEntrance() const {
+	if (_model == Microscopic) {
+		// The rearmost car must have pulled all of its length onto the lane.
+		return _cars.empty() || _cars.back()->getPosition() - _cars.back()->getLength() >= 0;
+	}
+
+	// One car per tick may enter, as on a microscopic lane where the entry cell must clear first.
+	return _queueCount < getCapacity() && _lastEntryTick != _tick;
 }
 
-void Car::accelerate()
-{
-	_speed += MIN_ACCEL_INTERVAL;
+void Lane::setModel(Model model) {
+	if (getCarCount() > 0) {
+		throw std::logic_error("Lane model can only be changed while the lane is empty");
+	}
+
+	_model = model;
+	_queue.clear();
+	_queueHead = 0;
+	_queueCount = 0;
+	_readyCount = 0;
+	if (_model == Microscopic) {
+		// One car per cell, so adding a car or merging in lane changes never reallocates.
+		_cars.reserve(_length + 1);
+		_mergedCars.reserve(_length + 1);
+	}
+
+	if (_model == Mesoscopic) {
+		// Match the microscopic model: cars cruise at one step per tick and are spaced a step apart when queued. The
+		// queue counts vehicles whatever their length.
+		int speed = Car::getCruiseSpeed();
+		for (int c = 0; c < VEHICLE_CLASS_COUNT; c++) {
+			_freeFlowTicks[c] = _length / VEHICLE_PARAMETERS[c].maxSpeed + 1;
+		}
+		_queue.resize(std::max(1, _length / speed));
+	}
 }
 
-void Car::decelerate()
-{
-	_speed -= MIN_ACCEL_INTERVAL;
+Car* Lane::advanceQueue(uint64_t tick) {
+	_tick = tick;
+
+	// Ready ticks never decrease along the queue, so the ready cars are a prefix of it that only grows from its end
+	// and shrinks from its front: each car is counted in once, whatever the length of the queue.
+	int capacity = getCapacity();
+	while (_readyCount < _queueCount && _queue[(_queueHead + _readyCount) % capacity].readyTick <= tick) {
+		_readyCount++;
+	}
 
-	if (_speed < 0) {
-		_speed = 0;
+	if (_queueCount == 0) {
+		return nullptr;
 	}
+
+	QueuedCar& head = _queue[_queueHead];
+	if (head.readyTick > tick || !_end.canEnter(this, head.car)) {
+		return nullptr;
+	}
+
+	Car* car = head.car;
+	_queueHead = (_queueHead + 1) % capacity;
+	_queueCount--;
+	_readyCount--;
+
+	_end.accept(this, car);
+	car->setLane(nullptr);
+	for (Detector& detector : _detectors) {
+		leaveDetector(detector);
+	}
+	countCars(-1);
+	return car;
 }
 
-bool Car::canMove() {
-	int laneLength = _lane->getLength();
-	int interval = _speed;
+int Lane::estimatePosition(const Car* car) const {
+	if (_model == Microscopic) {
+		return car->getPosition();
+	}
 
-	if (!isMoving()) {
-		interval = MIN_ACCEL_INTERVAL;
+	uint64_t travelled = (_tick - car->getLaneEntryTick()) * car->getParameters().maxSpeed;
+	return static_cast<int>(std::min<uint64_t>(travelled, _length));
+}
+
+int Lane::addDetector(int position, int length) {
+	if (position < 0 || position + length > _length + 1) {
+		throw std::invalid_argument("Detector must cover cells between 0 and the lane length");
+	}
+	// No car moves further than this in a tick, so none can jump over the detector without being seen on it.
+	if (length < MAX_VEHICLE_SPEED) {
+		throw std::invalid_argument("Detector must be at least " + std::to_string(MAX_VEHICLE_SPEED) + " cells long");
+	}
+	if (getCarCount() > 0) {
+		throw std::logic_error("Detectors can only be added while the lane is empty");
 	}
 
-	int futurePosition = _position + interval;
+	_detectors.push_back({ position, length });
+	return static_cast<int>(_detectors.size()) - 1;
+}
 
-	if (futurePosition > laneLength) {
-		return _lane->getEnd().canEnter(_lane);
+void Lane::enterDetector(Detector& detector) {
+	detector.occupancy++;
+	detector.count++;
+	_detectorOccupancy++;
+	_detectorCount++;
+}
+
+void Lane::leaveDetector(Detector& detector) {
+	detector.occupancy--;
+	_detectorOccupancy--;
+}
+
+void Lane::enterDetectors(int position) {
+	for (Detector& detector : _detectors) {
+		if (detector.covers(position)) {
+			enterDetector(detector);
+		}
 	}
-	else if (Car* interferingCar = _lane->findCarAt(futurePosition); interferingCar != nullptr) {
-		return interferingCar->canMove();
+}
+
+void Lane::leaveDetectors(int position) {
+	for (Detector& detector : _detectors) {
+		if (detector.covers(position)) {
+			leaveDetector(detector);
+		}
 	}
-	else {
-		return true;
+}
+
+void Lane::recordMove(int from, int to) {
+	for (Detector& detector : _detectors) {
+		bool wasOn = detector.covers(from);
+		bool isOn = detector.covers(to);
+		if (!wasOn && isOn) {
+			enterDetector(detector);
+		}
+		else if (wasOn && !isOn) {
+			leaveDetector(detector);
+		}
+	}
+}
+
+void Car::setSpeed(int speed)
+{
+	if (isMoving() && speed == 0) {
+		_stops++;
 	}
+	_speed = speed;
 }
 
 void Car::move()
@@ -107,9 +324,9 @@ void Car::move()
 	int futurePosition = _position + _speed;
 
 	if (futurePosition > laneLength) {
-		if (_lane->getEnd().canEnter(_lane)) {
+		if (_lane->getEnd().canEnter(_lane, this)) {
 			_lane->getEnd().accept(_lane, this);
-			_lane->removeCar(this);
+			_lane->removeFrontCar(this);
 			_lane = nullptr;
 		}
 
@@ -119,212 +336,589 @@ void Car::move()
 	_position = futurePosition;
 }
 
-Simulation::Simulation() :
-	laneA(originA, intersection, 50),
-	laneB(originB, intersection, 50),
-	laneC(originC, intersection, 50),
-	laneD(originD, intersection, 50),
-	laneE(intersection, terminalE, 50),
-	laneF(intersection, terminalF, 50),
-	laneG(intersection, terminalG, 50),
-	laneH(intersection, terminalH, 50)
-{
-	originA.setLane(&laneA);
-	originB.setLane(&laneB);
-	originC.setLane(&laneC);
-	originD.setLane(&laneD);
+Simulation::Simulation(Lane::Model laneModel) : Simulation(Scenario::createCross(), laneModel) {}
+
+Simulation::Simulation(const Scenario& scenario, Lane::Model laneModel) {
+	int nodeCount = static_cast<int>(scenario.nodes.size());
+	std::vector<Exitable*> beginnings(nodeCount, nullptr);
+	std::vector<Enterable*> ends(nodeCount, nullptr);
+	std::vector<Intersection*> intersections(nodeCount, nullptr);
+	_originAt.assign(nodeCount, nullptr);
+	_terminalAt.assign(nodeCount, -1);
+
+	for (int i = 0; i < nodeCount; i++) {
+		const Scenario::Node& node = scenario.nodes[i];
+		switch (node.kind) {
+		case Scenario::OriginNode:
+			_origins.push_back(std::make_unique<Origin>());
+			_origins.back()->setDemandPercent(node.demandPercent);
+			_origins.back()->setFleetMix(node.busPercent, node.truckPercent);
+			_originAt[i] = _origins.back().get();
+			beginnings[i] = _originAt[i];
+			break;
+		case Scenario::IntersectionNode:
+			_intersections.push_back(std::make_unique<Intersection>());
+			intersections[i] = _intersections.back().get();
+			beginnings[i] = intersections[i];
+			ends[i] = intersections[i];
+			break;
+		case Scenario::TerminalNode:
+			_terminals.push_back(std::make_unique<Terminal>());
+			// Terminal ids are the destination numbers used by the Router.
+			_terminals.back()->setId(static_cast<int>(_terminals.size()) - 1);
+			_terminalAt[i] = _terminals.back()->getId();
+			ends[i] = _terminals.back().get();
+			break;
+		}
+	}
+
+	_ownedLanes.reserve(scenario.lanes.size());
+	std::vector<size_t> terminalLanes(_terminals.size(), 0);
+	for (int i = 0; i < static_cast<int>(scenario.lanes.size()); i++) {
+		const Scenario::Lane& spec = scenario.lanes[i];
+		if (beginnings[spec.from] == nullptr || ends[spec.to] == nullptr) {
+			throw std::invalid_argument("Lane " + std::to_string(i) + " must run from an origin or intersection to an intersection or terminal");
+		}
+
+		_ownedLanes.push_back(std::make_unique<Lane>(*beginnings[spec.from], *ends[spec.to], spec.length));
+		Lane* lane = _ownedLanes.back().get();
+		lane->setId(i);
+		lane->setModel(laneModel == Lane::Mesoscopic || spec.isMesoscopic ? Lane::Mesoscopic : Lane::Microscopic);
+		_lanes.push_back(lane);
+		_laneSignals.push_back(intersections[spec.to]);
+
+		if (_originAt[spec.from] != nullptr) {
+			_originAt[spec.from]->addLane(lane);
+		}
+		if (_terminalAt[spec.to] >= 0) {
+			terminalLanes[_terminalAt[spec.to]]++;
+		}
+	}
+	for (size_t i = 0; i < _terminals.size(); i++) {
+		_terminals[i]->reserve(terminalLanes[i]);
+	}
+	for (const Scenario::Detector& detector : scenario.detectors) {
+		_lanes.at(detector.lane)->addDetector(detector.position, detector.length);
+	}
+	_statistics.resize(static_cast<int>(_lanes.size()));
+
+	// Until a plan is set, approaches alternate between starting on green and on red in the order they are connected.
+	std::vector<int> approachCount(nodeCount, 0);
+	std::vector<bool> isConnected(_lanes.size(), false);
+	for (const Scenario::Turn& turn : scenario.turns) {
+		const Scenario::Lane& from = scenario.lanes.at(turn.fromLane);
+		const Scenario::Lane& to = scenario.lanes.at(turn.toLane);
+		Intersection* intersection = intersections[from.to];
+		if (intersection == nullptr || from.to != to.from) {
+			throw std::invalid_argument("Turn from lane " + std::to_string(turn.fromLane) + " to lane " + std::to_string(turn.toLane) + " does not pass through an intersection");
+		}
+
+		Intersection::Colors initialSignal = Intersection::Red;
+		if (!isConnected[turn.fromLane]) {
+			isConnected[turn.fromLane] = true;
+			initialSignal = approachCount[from.to]++ % 2 == 0 ? Intersection::Green : Intersection::Red;
+		}
+		intersection->createConnection(_lanes[turn.fromLane], _lanes[turn.toLane], initialSignal);
+	}
+	// A car reaching the end of a lane with no turn would have nowhere to go.
+	for (size_t i = 0; i < scenario.lanes.size(); i++) {
+		int node = scenario.lanes[i].to;
+		if (intersections[node] != nullptr && !isConnected[i]) {
+			throw std::invalid_argument("Lane " + std::to_string(i) + " ends at intersection " + std::to_string(node) + " but has no turn");
+		}
+	}
+
+	for (const Scenario::Boundary& boundary : scenario.boundaries) {
+		std::vector<Lane*> clockwise;
+		for (int lane : boundary.lanes) {
+			clockwise.push_back(_lanes.at(lane));
+		}
+		Intersection* intersection = intersections.at(boundary.node);
+		if (intersection == nullptr) {
+			throw std::invalid_argument("Boundary order for node " + std::to_string(boundary.node) + ", which is not an intersection");
+		}
+		intersection->setBoundaryOrder(clockwise);
+	}
+
+	for (const Scenario::Road& spec : scenario.roads) {
+		std::vector<Lane*> lanes;
+		for (int lane : spec.lanes) {
+			lanes.push_back(_lanes.at(lane));
+		}
+		_roads.emplace_back(lanes);
+	}
+
+	for (const Scenario::Plan& spec : scenario.plans) {
+		SignalPlan plan;
+		plan.offsetTicks = spec.offsetTicks;
+		plan.control = spec.control == Scenario::GapOut ? SignalPlan::GapOut
+			: spec.control == Scenario::QueueLength ? SignalPlan::QueueLength : SignalPlan::FixedTime;
+		plan.controlTicks = spec.controlTicks;
+		for (const Scenario::Phase& phaseSpec : spec.phases) {
+			SignalPhase phase;
+			phase.greenTicks = phaseSpec.greenTicks;
+			phase.yellowTicks = phaseSpec.yellowTicks;
+			phase.allRedTicks = phaseSpec.allRedTicks;
+			phase.maxGreenTicks = phaseSpec.maxGreenTicks;
+			for (int lane : phaseSpec.lanes) {
+				phase.approaches.push_back(_lanes.at(lane));
+			}
+			plan.phases.push_back(phase);
+		}
+		Intersection* intersection = intersections.at(spec.node);
+		if (intersection == nullptr) {
+			throw std::invalid_argument("Signal plan for node " + std::to_string(spec.node) + ", which is not an intersection");
+		}
+		intersection->setSignalPlan(plan);
+	}
+
+	_router.build(_lanes);
+	for (Lane* lane : _lanes) {
+		_reachableDestinations.push_back(_router.getReachableDestinations(lane));
+	}
 
-	intersection.createConnection(&laneA, &laneE, Intersection::Red);
-	intersection.createConnection(&laneB, &laneF, Intersection::Green);
-	intersection.createConnection(&laneC, &laneG, Intersection::Red);
-	intersection.createConnection(&laneD, &laneH, Intersection::Green);
+	buildLaneGeometry(scenario);
 
 	Notifications::subscribe(Notifications::DELETE_CAR_MESSAGE, this);
 	Notifications::subscribe(Notifications::CREATE_CAR_MESSAGE, this);
 }
 
+void Simulation::buildLaneGeometry(const Scenario& scenario) {
+	std::vector<int> lateralIndex(scenario.lanes.size(), 0);
+	for (const Scenario::Road& road : scenario.roads) {
+		for (size_t i = 0; i < road.lanes.size(); i++) {
+			lateralIndex[road.lanes[i]] = static_cast<int>(i);
+		}
+	}
+
+	std::vector<Renderer::LaneGeometry> geometry;
+	for (size_t i = 0; i < scenario.lanes.size(); i++) {
+		const Scenario::Lane& spec = scenario.lanes[i];
+		const Scenario::Node& from = scenario.nodes[spec.from];
+		const Scenario::Node& to = scenario.nodes[spec.to];
+		geometry.push_back({ from.x, from.y, to.x, to.y, spec.length, lateralIndex[i] });
+	}
+	_renderer.setGeometry(geometry);
+}
+
+Simulation::~Simulation() {
+	Notifications::unsubscribe(this);
+}
+
 void Simulation::notify(const std::string& message, const std::any& data) {
 
 	if (message == Notifications::DELETE_CAR_MESSAGE) {
 		try {
 			Car* car = std::any_cast<Car*>(data);
-
 			auto iter = std::find_if(_cars.begin(), _cars.end(), [car](std::unique_ptr<Car>& uniqueCar) {
 				return uniqueCar.get() == car;
 				});
+			// Every Simulation in the process hears every notification; this car belongs to another one.
+			if (iter == _cars.end()) {
+				return;
+			}
 
+			uint32_t travelTicks = static_cast<uint32_t>(_tick - car->getDepartureTick());
+			_statistics.recordTrip(travelTicks, car->getStops());
+			_events.log(EventRecord::TripCompleted, _tick, travelTicks, car->getStops());
+
+			// Kept for the next car rather than freed, so a steady flow of cars does not allocate.
+			_spareCars.push_back(std::move(*iter));
 			_cars.erase(iter);
 		}
-		catch (const std::bad_any_cast& e) {
-			// Log to observability service
-			std::cerr << "Bad any_cast in notify(): " << e.what() << std::endl;
+		catch (const std::bad_any_cast&) {
+			_events.log(EventRecord::BadNotification, _tick, 0);
 		}
 	}
 	else if (message == Notifications::CREATE_CAR_MESSAGE) {
 		try {
-			Lane* lane = std::any_cast<Lane*>(data);
-			if (!lane->findCarAt(0)) {
-				std::unique_ptr<Car> car = std::make_unique<Car>();
+			const Origin::Departure& departure = *std::any_cast<Origin::Departure*>(data);
+			Lane* lane = departure.lane;
+			if (lane->getId() < 0 || lane->getId() >= getLaneCount() || _lanes[lane->getId()] != lane) {
+				return;
+			}
+			if (lane->hasRoomAtEntrance()) {
+				std::unique_ptr<Car> car;
+				if (!_spareCars.empty()) {
+					car = std::move(_spareCars.back());
+					_spareCars.pop_back();
+					*car = Car();
+				}
+				else {
+					car = std::make_unique<Car>();
+				}
 				car->setLane(lane);
+				car->setDepartureTick(_tick);
+				car->setVehicleClass(departure.vehicleClass);
+
+				const std::vector<int>& destinations = _reachableDestinations[lane->getId()];
+				if (departure.destination >= 0) {
+					car->setDestination(departure.destination);
+				}
+				else if (!destinations.empty()) {
+					std::uniform_int_distribution<size_t> pick(0, destinations.size() - 1);
+					car->setDestination(destinations[pick(_random)]);
+				}
 				lane->addCar(car.get());
+				_events.log(EventRecord::CarCreated, _tick, lane->getId(), static_cast<uint32_t>(car->getDestination()));
 				_cars.push_back(std::move(car));
 			}
 		}
-		catch (const std::bad_any_cast& e) {
-			// Log to observability service
-			std::cerr << "Bad any_cast in notify(): " << e.what() << std::endl;
+		catch (const std::bad_any_cast&) {
+			_events.log(EventRecord::BadNotification, _tick, 1);
 		}
 	}
 }
 
-void Simulation::runSimulationThread() {
-	_simulationCycle = std::async(std::launch::async, [this]() {
-		std::array<Lane*, 8> lanes { &laneA, &laneB, &laneC, &laneD, &laneE, &laneF, &laneG, &laneH };
-		static constexpr std::chrono::milliseconds SIMULATION_INTERVAL_MS(250);
-		
-
-		while (_isRunning) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(SIMULATION_INTERVAL_MS));
-			std::lock_guard<std::mutex> lock(_simulationMutex);
-			
-			for (Lane* lane : lanes) {
-				lane->getEnd().processBeforeTick();
-			}
+void Simulation::tick() {
+	{
+		AllocationTracker::Scope scope(AllocationTracker::Signals);
+		for (const std::unique_ptr<Intersection>& intersection : _intersections) {
+			intersection->setTick(_tick);
+			intersection->processBeforeTick();
+		}
+	}
+	{
+		AllocationTracker::Scope scope(AllocationTracker::Arrivals);
+		for (const std::unique_ptr<Terminal>& terminal : _terminals) {
+			terminal->processBeforeTick();
+		}
+	}
 
-			for (const std::unique_ptr<Car>& car : _cars) {
-				if (car->getLane() != nullptr) {
-					if (car->canMove()) {
-						if (!car->isMoving()) {
-							car->accelerate();
-						}
-					}
-					else {
-						if (car->isMoving()) {
-							car->decelerate();
-						}
-					}
-					car->move();
+	{
+		AllocationTracker::Scope scope(AllocationTracker::Queues);
+		for (Lane* lane : _lanes) {
+			if (lane->getModel() == Lane::Mesoscopic) {
+				if (Car* car = lane->advanceQueue(_tick); car != nullptr) {
+					_statistics.recordLaneExit(lane->getId());
+					_events.log(EventRecord::LaneExit, _tick, lane->getId(), static_cast<uint32_t>(car->getDestination()));
 				}
+				_statistics.recordQueuedCars(lane->getId(), lane->getQueuedCount());
 			}
+		}
+	}
 
-			for (Lane* lane : lanes) {
-				lane->getBeginning().processAfterTick();
+	{
+		AllocationTracker::Scope scope(AllocationTracker::LaneChanges);
+		for (Road& road : _roads) {
+			for (const Road::LaneChange& change : road.changeLanes(_router)) {
+				_events.log(EventRecord::LaneChange, _tick, change.from->getId(), change.to->getId(), change.car->getPosition());
 			}
+		}
+	}
 
-			render();
-		}
-		});
-}
-
-void Simulation::runMonitorThread() {
-	_monitorCycle = std::async(std::launch::async, [this]() {
-		std::vector<std::pair<Lane*, int>> lanePositions;
-		lanePositions.resize(400);
-
-		std::ofstream logFile;
-		logFile.open("collisions.log", std::ofstream::trunc);
-		if (!logFile.is_open()) {
-			std::cerr << "Failed to open collisions.log" << std::endl;
-			return;
-		}
-
-		while (_isRunning) {
-			lanePositions.clear();
-			std::this_thread::sleep_for(std::chrono::milliseconds(125));
-			std::lock_guard<std::mutex> lock(_simulationMutex);
-			int index = 0;
-			for (auto& car : _cars) {
-				int carPosition = car->getPosition();
-				if (car->getLane() != nullptr) {
-					for (std::pair<Lane*, int>& position : lanePositions) {
-						if (car->getLane() == position.first && car->getPosition() == position.second) {
-							logFile << "***Collision involving " << car << " (index " << index++ << ") at " << carPosition << " and " << position.second << " at lane " << position.first << std::endl;
-						}
-					}
-					lanePositions.push_back(std::pair<Lane*, int>(car->getLane(), carPosition));
-				}
-			}
-			logFile.flush();
+	{
+		AllocationTracker::Scope scope(AllocationTracker::Movement);
+		moveCars();
+	}
+
+	if (_demand != nullptr) {
+		AllocationTracker::Scope scope(AllocationTracker::Demand);
+		dispatchTrips();
+	}
+	{
+		AllocationTracker::Scope scope(AllocationTracker::Departures);
+		for (const std::unique_ptr<Origin>& origin : _origins) {
+			origin->processAfterTick();
 		}
-		});
+	}
+	{
+		AllocationTracker::Scope scope(AllocationTracker::Intersections);
+		for (const std::unique_ptr<Intersection>& intersection : _intersections) {
+			intersection->processAfterTick();
+		}
+	}
+
+	AllocationTracker::Scope scope(AllocationTracker::Bookkeeping);
+	if (_events.isOpen()) {
+		logSignalChanges();
+	}
+
+	_statistics.endTick(_tick);
+	_tick++;
+	publishMetrics();
 }
 
-void Simulation::start() {
-	intersection.startTrafficSignals();
-	_isRunning = true;
-	runSimulationThread();
-	runMonitorThread();
+int Simulation::getCarCapacity() const {
+	int capacity = 0;
+	for (Lane* lane : _lanes) {
+		capacity += lane->getModel() == Lane::Mesoscopic ? lane->getCapacity() : lane->getLength() + 1;
+		capacity += 1;
+	}
+	for (const std::unique_ptr<Intersection>& intersection : _intersections) {
+		capacity += intersection->getMovementCount();
+	}
+	return capacity;
 }
 
-void Simulation::stop() {
-	_isRunning = false;
-	intersection.stopTrafficSignals();
+void Simulation::reserveCars(int count) {
+	_cars.reserve(count);
+	_spareCars.reserve(count);
+	while (static_cast<int>(_cars.size() + _spareCars.size()) < count) {
+		_spareCars.push_back(std::make_unique<Car>());
+	}
 }
 
-void Simulation::render() {
-	_renderer.renderLanes();
+void Simulation::moveCars() {
+	// Each lane's cars move front first, so a car's decision sees the car ahead of it after that car has moved. Storage
+	// stays in position order for that, and the cars of one class in a row are moved together by the kernel specialized
+	// for the class, so a lane of one class costs a single dispatch.
+	for (Lane* lane : _lanes) {
+		if (lane->getModel() != Lane::Microscopic) {
+			continue;
+		}
 
-	Intersection::Colors color = intersection.getSignal(&laneA);	
-	_renderer.renderStopLight(Renderer::Top, convertSignalToScreen(color));
+		const std::vector<Car*>& cars = lane->getCars();
+		for (size_t i = 0; i < cars.size();) {
+			switch (cars[i]->getVehicleClass()) {
+			case PassengerCar:
+				i = moveRun<PassengerCar>(lane, i);
+				break;
+			case Bus:
+				i = moveRun<Bus>(lane, i);
+				break;
+			case Truck:
+				i = moveRun<Truck>(lane, i);
+				break;
+			}
+		}
+	}
+}
 
-	color = intersection.getSignal(&laneB);
-	_renderer.renderStopLight(Renderer::Left, convertSignalToScreen(color));
+template <VehicleClass C>
+size_t Simulation::moveRun(Lane* lane, size_t first) {
+	constexpr VehicleParameters P = VEHICLE_PARAMETERS[C];
+	const std::vector<Car*>& cars = lane->getCars();
+	int laneLength = lane->getLength();
+	Enterable& end = lane->getEnd();
+
+	// The furthest cell a car may move to: the one behind the tail of the car ahead, which has already moved. Only the
+	// first car of the run reads another car's length; after that the car ahead is of class C.
+	int limit = INT_MAX;
+	if (first > 0) {
+		limit = cars[first - 1]->getPosition() - cars[first - 1]->getLength();
+	}
 
-	color = intersection.getSignal(&laneC);
-	_renderer.renderStopLight(Renderer::Bottom, convertSignalToScreen(color));
+	size_t i = first;
+	while (i < cars.size() && cars[i]->getVehicleClass() == C) {
+		Car* car = cars[i];
+		int from = car->getPosition();
+		int speed = std::min(car->getSpeed() + P.acceleration, P.maxSpeed);
+		int target = from + speed;
+		if (target > limit || (target > laneLength && !end.canEnter(lane, car))) {
+			// Brake as hard as the class allows, and harder if that is what it takes to stay behind the car ahead or
+			// short of the end of the lane.
+			int room = std::max(std::min(limit, laneLength) - from, 0);
+			speed = std::min(std::max(car->getSpeed() - P.deceleration, 0), room);
+			if (car->isMoving() && speed == 0) {
+				_statistics.recordStop();
+			}
+		}
+		car->setSpeed(speed);
+		car->move();
+
+		// Only the front car can leave, and then the next car takes its index with nothing ahead of it.
+		if (car->getLane() != lane) {
+			_statistics.recordLaneExit(lane->getId());
+			_events.log(EventRecord::LaneExit, _tick, lane->getId(), static_cast<uint32_t>(car->getDestination()));
+			limit = INT_MAX;
+			continue;
+		}
+		int to = car->getPosition();
+		if (to != from) {
+			lane->recordMove(from, to);
+		}
+		if (speed == 0) {
+			_statistics.recordQueuedCar(lane->getId());
+		}
+		limit = to - P.length;
+		i++;
+	}
+	return i;
+}
 
-	color = intersection.getSignal(&laneD);
-	_renderer.renderStopLight(Renderer::Right, convertSignalToScreen(color));
+void Simulation::setDemand(std::unique_ptr<DemandStream> demand) {
+	_demand = std::move(demand);
+	for (const std::unique_ptr<Origin>& origin : _origins) {
+		origin->setDemandPercent(0);
+	}
+}
 
-	for (const std::unique_ptr<Car>& car : _cars) {
-		if (car->getLane() == nullptr) {
+void Simulation::dispatchTrips() {
+	_dueTrips.clear();
+	_demand->takeDue(_tick, _dueTrips);
+
+	int nodeCount = static_cast<int>(_originAt.size());
+	for (const DemandStream::Trip& trip : _dueTrips) {
+		bool isValid = trip.origin >= 0 && trip.origin < nodeCount && _originAt[trip.origin] != nullptr
+			&& trip.destination >= 0 && trip.destination < nodeCount && _terminalAt[trip.destination] >= 0;
+		// A car bound for a terminal it cannot reach would follow its lanes' first exits and finish somewhere else.
+		if (isValid) {
+			const std::vector<Lane*>& lanes = _originAt[trip.origin]->getLanes();
+			int destination = _terminalAt[trip.destination];
+			isValid = std::any_of(lanes.begin(), lanes.end(), [this, destination](const Lane* lane) {
+				return _router.getDistance(lane, destination) < Router::UNREACHABLE;
+				});
+		}
+		if (!isValid) {
+			_events.log(EventRecord::BadTrip, _tick, static_cast<uint32_t>(trip.origin), static_cast<uint32_t>(trip.destination));
 			continue;
 		}
+		_originAt[trip.origin]->dispatch(_terminalAt[trip.destination]);
+	}
+}
 
-		int pos = car->getPosition();
-		int laneLength = car->getLane()->getLength();
-		Renderer::Axis axis = Renderer::Top;
-		Renderer::Heading heading = Renderer::In;
-
-		// Lanes moving toward intersection, starting from top, counter-clockwise
-		if (car->getLane() == &laneA) {
-			axis = Renderer::Top;
-			heading = Renderer::In;
+void Simulation::logSignalChanges() {
+	for (Lane* lane : _lanes) {
+		Intersection* intersection = _laneSignals[lane->getId()];
+		if (intersection == nullptr) {
+			continue;
 		}
-		else if (car->getLane() == &laneB) {
-			axis = Renderer::Left;
-			heading = Renderer::In;
+
+		int elapsed = 0;
+		int duration = 0;
+		intersection->getPhaseProgress(lane, elapsed, duration);
+		if (elapsed == 0) {
+			_events.log(EventRecord::SignalChange, _tick, lane->getId(), intersection->getSignal(lane), duration);
 		}
-		else if (car->getLane() == &laneC) {
-			axis = Renderer::Bottom;
-			heading = Renderer::In;
+	}
+}
+
+void Simulation::monitor() {
+	for (Lane* lane : _lanes) {
+		// Mesoscopic lanes have no cell positions to collide in.
+		if (lane->getModel() != Lane::Microscopic) {
+			continue;
 		}
-		else if (car->getLane() == &laneD) {
-			axis = Renderer::Right;
-			heading = Renderer::In;
+		const std::vector<Car*>& cars = lane->getCars();
+		for (size_t i = lane->findCollision(1); i < cars.size(); i = lane->findCollision(i + 1)) {
+			_events.log(EventRecord::Collision, _tick, lane->getId(), cars[i]->getPosition(), static_cast<uint32_t>(i));
 		}
-		// Lanes moving away from intersection, starting from bottom, counter-clockwise
-		else if (car->getLane() == &laneE) {
-			axis = Renderer::Bottom;
-			heading = Renderer::Out;
+	}
+}
+
+void Simulation::start(Scheduler& scheduler) {
+	static constexpr std::chrono::milliseconds SIMULATION_INTERVAL_MS(250);
+	// Car positions only change on a tick, so there is nothing to gain from checking for collisions more often.
+	static constexpr std::chrono::milliseconds MONITOR_INTERVAL_MS(250);
+
+	_statisticsFile.open("statistics.csv", std::ofstream::trunc);
+	if (_statisticsFile.is_open()) {
+		_statistics.setExport(&_statisticsFile, Statistics::Csv);
+	}
+	else {
+		std::cerr << "Failed to open statistics.csv" << std::endl;
+	}
+
+	if (!_metrics.create()) {
+		std::cerr << "Failed to create shared-memory metrics segment (is another simulation running?)" << std::endl;
+	}
+	_rateWindowStart = std::chrono::steady_clock::now();
+	_rateWindowTick = _tick;
+	trackOccupancy(true);
+
+	_scheduler = &scheduler;
+	_timers.push_back(scheduler.every(SIMULATION_INTERVAL_MS, [this]() {
+		tick();
+		render();
+		}));
+
+	if (_events.open("events.bin")) {
+		_timers.push_back(scheduler.every(MONITOR_INTERVAL_MS, [this]() { monitor(); }));
+	}
+	else {
+		std::cerr << "Failed to open events.bin" << std::endl;
+	}
+}
+
+void Simulation::stop() {
+	if (_scheduler != nullptr) {
+		for (int timer : _timers) {
+			_scheduler->cancel(timer);
 		}
-		else if (car->getLane() == &laneF) {
-			axis = Renderer::Right;
-			heading = Renderer::Out;
+		_timers.clear();
+		_scheduler = nullptr;
+	}
+
+	trackOccupancy(false);
+	_statistics.flush();
+	_events.close();
+}
+
+void Simulation::trackOccupancy(bool isTracking) {
+	SpatialIndex& index = _renderer.getIndex();
+	index.clearLoads();
+	for (Lane* lane : _lanes) {
+		if (isTracking) {
+			index.addLoad(lane->getId(), lane->getCarCount());
 		}
-		else if (car->getLane() == &laneG) {
-			axis = Renderer::Top;
-			heading = Renderer::Out;
+		lane->setOccupancyIndex(isTracking ? &index : nullptr);
+	}
+}
+
+void Simulation::publishMetrics() {
+	if (!_metrics.isOpen()) {
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::duration<double> window = now - _rateWindowStart;
+	if (window.count() >= 1.0) {
+		_ticksPerSecond = (_tick - _rateWindowTick) / window.count();
+		_rateWindowStart = now;
+		_rateWindowTick = _tick;
+	}
+
+	MetricsSegment& segment = _metrics.beginWrite();
+	segment.tick = _tick;
+	segment.ticksPerSecond = _ticksPerSecond;
+	segment.carCount = static_cast<uint32_t>(_cars.size());
+	segment.laneCount = static_cast<uint32_t>(std::min<size_t>(_lanes.size(), MetricsSegment::MAX_LANES));
+	segment.totalLaneCount = static_cast<uint32_t>(_lanes.size());
+
+	for (uint32_t i = 0; i < segment.laneCount; i++) {
+		Lane* lane = _lanes[i];
+		segment.laneOccupancy[i] = lane->getCarCount();
+
+		if (Intersection* intersection = _laneSignals[i]; intersection != nullptr) {
+			int elapsed = 0;
+			int duration = 0;
+			intersection->getPhaseProgress(lane, elapsed, duration);
+			segment.signalState[i] = static_cast<uint8_t>(intersection->getSignal(lane));
+			segment.phaseElapsed[i] = elapsed;
+			segment.phaseDuration[i] = duration;
 		}
-		else if (car->getLane() == &laneH) {
-			axis = Renderer::Left;
-			heading = Renderer::Out;
+		else {
+			segment.signalState[i] = MetricsSegment::NO_SIGNAL;
+			segment.phaseElapsed[i] = 0;
+			segment.phaseDuration[i] = 0;
 		}
+	}
+	_metrics.endWrite();
+}
+
+void Simulation::render() {
+	// Indexed by VehicleClass.
+	static constexpr char CAR_GLYPHS[VEHICLE_CLASS_COUNT] = { 'O', 'B', 'T' };
+
+	int columns = 0;
+	int rows = 0;
+	ScreenWriter::getSize(columns, rows);
 
-		_renderer.renderCar(axis, heading, pos, laneLength);
+	// One column short of the console, so a full row never wraps onto the next.
+	const std::vector<int>& visibleLanes = _renderer.beginFrame(columns - 1, rows);
+	if (!_renderer.isDetailed()) {
+		_renderer.drawDensity();
+	}
+	for (int id : visibleLanes) {
+		Lane* lane = _lanes[id];
+		Intersection* intersection = _laneSignals[id];
+		_renderer.drawLane(id, intersection != nullptr ? &convertSignalToScreen(intersection->getSignal(lane)) : nullptr);
+		lane->forEachCar([this, lane, id](const Car* car) { _renderer.drawCar(id, lane->estimatePosition(car), CAR_GLYPHS[car->getVehicleClass()]); });
 	}
 
 	_renderer.renderVolumeGraph(static_cast<int>(_cars.size()));
+	_renderer.present(_tick, static_cast<int>(_cars.size()));
 }
 
 const std::string& Simulation::convertSignalToScreen(Intersection::Colors color) const
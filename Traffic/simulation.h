@@ -1,73 +1,280 @@
 #pragma once
+#include "demand.h"
+#include "event_log.h"
+#include "metrics.h"
 #include "notifications.h"
 #include "renderer.h"
+#include "road.h"
+#include "routing.h"
+#include "scenario.h"
+#include "scheduler.h"
+#include "statistics.h"
 #include "traffic_nodes.h"
+#include "vehicle_class.h"
 
 #include <any>
-#include <future>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
 #include <memory>
-#include <mutex>
+#include <random>
 #include <string>
+#include <utility>
 #include <vector>
 
 class Lane {
+public:
+	// Microscopic lanes move every car cell by cell (Simulation::moveRun). Mesoscopic lanes are a FIFO queue with a
+	// capacity and a free-flow travel time: a car may leave once it has spent the free-flow time on the lane and the
+	// end of the lane will accept it, so the per-tick cost is independent of how many cars are on the lane.
+	enum Model { Microscopic, Mesoscopic };
+
+	// A virtual loop detector over cells [position, position + length) of the lane. Its counters change only when a car
+	// enters the lane, moves along it or leaves it, at a cost per event of the lane's few detectors, so reading them
+	// never means scanning the lane. On a mesoscopic lane, which has no cells, a car covers every detector from the tick
+	// it enters the lane until the tick it leaves.
+	struct Detector {
+		int position;
+		int length;
+		// Cars on the detector now.
+		int occupancy = 0;
+		// Cars that have reached the detector.
+		uint32_t count = 0;
+
+		bool covers(int cell) const { return cell >= position && cell < position + length; }
+	};
 private:
+	struct QueuedCar {
+		Car* car;
+		uint64_t readyTick;
+	};
+
 	int _length;
+	int _id = -1;
+	int _endSlot = -1;
+	// Microscopic lanes only. Sorted by position, front of the lane first, so the car ahead of _cars[i] is _cars[i - 1].
 	std::vector<Car*> _cars;
+	// Scratch for exchangeCars(), swapped with _cars so that neither ever reallocates.
+	std::vector<Car*> _mergedCars;
 	Exitable& _beginning;
 	Enterable& _end;
+
+	Model _model = Microscopic;
+	// Indexed by VehicleClass.
+	int _freeFlowTicks[VEHICLE_CLASS_COUNT] = {};
+	std::vector<QueuedCar> _queue;
+	int _queueHead = 0;
+	int _queueCount = 0;
+	// Cars at the front of the queue that have covered the free-flow time, as of the last advanceQueue().
+	int _readyCount = 0;
+	uint64_t _tick = 0;
+	uint64_t _lastEntryTick = UINT64_MAX;
+
+	std::vector<Detector> _detectors;
+	// Sums over the detectors, kept with them so that a controller reads one pair of values per lane.
+	int _detectorOccupancy = 0;
+	uint32_t _detectorCount = 0;
+
+	void enterDetector(Detector& detector);
+	void leaveDetector(Detector& detector);
+	// Enters or leaves every detector covering the cell.
+	void enterDetectors(int position);
+	void leaveDetectors(int position);
+
+	SpatialIndex* _occupancyIndex = nullptr;
+	void countCars(int delta) {
+		if (_occupancyIndex != nullptr) {
+			_occupancyIndex->addLoad(_id, delta);
+		}
+	}
 public:
 	Lane(Exitable& beginning, Enterable& end, int length) : _beginning(beginning), _end(end), _length(length) {}
 	int getLength() const { return _length; }
+	int getId() const { return _id; }
+	void setId(int id) { _id = id; }
+	// Index the Enterable at the end of this lane uses for it, so it can look up per-approach state without a search.
+	int getEndSlot() const { return _endSlot; }
+	void setEndSlot(int slot) { _endSlot = slot; }
 	Enterable& getEnd() const { return _end; }
 	Exitable& getBeginning() const { return _beginning; }
-	void addCar(Car* car) { _cars.push_back(car); }
-	void removeCar(Car* car);
+	int getCarCount() const { return _model == Mesoscopic ? _queueCount : static_cast<int>(_cars.size()); }
+	void addCar(Car* car);
+	// Microscopic lanes only. Removes the car at the front of the lane, the only one that can drive off its end. Throws
+	// std::logic_error if the car is not at the front.
+	void removeFrontCar(Car* car);
+	// Microscopic lanes only. Applies a batch of lane changes in one pass over the lane: drops the cars whose lane is no
+	// longer this one and merges in `arriving`, which must be sorted front first.
+	void exchangeCars(const std::vector<Car*>& arriving);
 	Car* findCarAt(int position) const;
+	// True if no car is between the two positions, inclusive.
+	bool isClear(int from, int to) const;
+	// Microscopic lanes only. Index of the first car, from cars[first] on, whose front reaches into the car ahead of it,
+	// or the number of cars if none does.
+	size_t findCollision(size_t first) const;
+	const std::vector<Car*>& getCars() const { return _cars; }
+	// Calls visit(car) for every car on the lane, microscopic or mesoscopic, front first.
+	template <typename Visit>
+	void forEachCar(Visit visit) const;
+	bool hasRoomAtEntrance() const;
+
+	Model getModel() const { return _model; }
+	void setModel(Model model);
+	int getCapacity() const { return static_cast<int>(_queue.size()); }
+	int getFreeFlowTicks(VehicleClass vehicleClass = PassengerCar) const { return _freeFlowTicks[vehicleClass]; }
+	// Mesoscopic lanes only. Releases the head of the queue to the end of the lane if it is due and accepted, and
+	// returns it (or nullptr).
+	Car* advanceQueue(uint64_t tick);
+	// Mesoscopic lanes only. Cars that have covered the free-flow time but are still waiting to leave.
+	int getQueuedCount() const { return _readyCount; }
+	// Where to draw a car: its cell on a microscopic lane, or an estimate from its time on a mesoscopic lane.
+	int estimatePosition(const Car* car) const;
+
+	// Returns the detector's index on the lane. Throws std::invalid_argument unless it lies within the lane and is at
+	// least MAX_VEHICLE_SPEED cells long, and std::logic_error if the lane has cars on it.
+	int addDetector(int position, int length);
+	const std::vector<Detector>& getDetectors() const { return _detectors; }
+	int getDetectorOccupancy() const { return _detectorOccupancy; }
+	uint32_t getDetectorCount() const { return _detectorCount; }
+	// Microscopic lanes only. Updates the detectors for a car that moved from one cell of the lane to another.
+	void recordMove(int from, int to);
+	// Adds each car entering the lane to the index item numbered by the lane id as a load of 1, and each car leaving
+	// it as -1, so a heatmap stays current without visiting the lane. nullptr stops it.
+	void setOccupancyIndex(SpatialIndex* index) { _occupancyIndex = index; }
 };
 
 class Car {
 private:
-	static const int MIN_ACCEL_INTERVAL;
 	int _speed = 0;
 	Lane* _lane = nullptr;
 	int _position = 0;
+	uint64_t _departureTick = 0;
+	uint64_t _laneEntryTick = 0;
+	int _destination = -1;
+	uint32_t _stops = 0;
+	VehicleClass _class = PassengerCar;
 public:
+	// Free-flow speed of a passenger car, the class travel times and lane lengths are planned around.
+	static constexpr int getCruiseSpeed() { return VEHICLE_PARAMETERS[PassengerCar].maxSpeed; }
+	VehicleClass getVehicleClass() const { return _class; }
+	void setVehicleClass(VehicleClass vehicleClass) { _class = vehicleClass; }
+	const VehicleParameters& getParameters() const { return VEHICLE_PARAMETERS[_class]; }
+	int getLength() const { return getParameters().length; }
 	void setLane(Lane* lane) { _lane = lane; }
 	Lane* getLane() const { return _lane; }
 	bool isMoving() const { return _speed > 0; }
-	bool canMove();
+	int getSpeed() const { return _speed; }
+	// Counts a stop if the car was moving and the new speed is zero.
+	void setSpeed(int speed);
 	int getPosition() const { return _position; }
 	void resetPosition() { _position = 0; }
-	void accelerate();
-	void decelerate();
+	uint64_t getDepartureTick() const { return _departureTick; }
+	void setDepartureTick(uint64_t tick) { _departureTick = tick; }
+	// Destination Terminal id, or -1 to drive straight on wherever the lane leads.
+	int getDestination() const { return _destination; }
+	void setDestination(int destination) { _destination = destination; }
+	uint64_t getLaneEntryTick() const { return _laneEntryTick; }
+	void setLaneEntryTick(uint64_t tick) { _laneEntryTick = tick; }
+	uint32_t getStops() const { return _stops; }
+	// Advances the car by its speed, or hands it to the end of the lane if that takes it past the last cell. The speed
+	// is chosen by Simulation::moveRun.
 	void move();
 };
 
+template <typename Visit>
+void Lane::forEachCar(Visit visit) const {
+	if (_model == Microscopic) {
+		for (const Car* car : _cars) {
+			visit(car);
+		}
+		return;
+	}
+
+	for (int i = 0; i < _queueCount; i++) {
+		visit(_queue[(_queueHead + i) % _queue.size()].car);
+	}
+}
+
 class Simulation : public Subscriber
 {
 private:
-	Intersection intersection;
-	Origin originA, originB, originC, originD;
-	Terminal terminalE, terminalF, terminalG, terminalH;
-	Lane laneA, laneB, laneC, laneD, laneE, laneF, laneG, laneH;
+	std::vector<std::unique_ptr<Origin>> _origins;
+	std::vector<std::unique_ptr<Intersection>> _intersections;
+	std::vector<std::unique_ptr<Terminal>> _terminals;
+	std::vector<std::unique_ptr<Lane>> _ownedLanes;
+	// Indexed by lane id.
+	std::vector<Lane*> _lanes;
+	std::vector<Road> _roads;
+	// Indexed by lane id: the Intersection whose signal the lane waits at, if any.
+	std::vector<Intersection*> _laneSignals;
+
+	Router _router;
+	// Indexed by lane id: the destinations a car starting on that lane can reach.
+	std::vector<std::vector<int>> _reachableDestinations;
+	std::mt19937 _random { std::random_device()() };
+
+	// Indexed by scenario node id: the Origin there, and the destination id of the Terminal there (or -1).
+	std::vector<Origin*> _originAt;
+	std::vector<int> _terminalAt;
+	std::unique_ptr<DemandStream> _demand;
+	std::vector<DemandStream::Trip> _dueTrips;
 
 	std::vector<std::unique_ptr<Car>> _cars;
-	std::mutex _simulationMutex;
-	bool _isRunning = false;
+	std::vector<std::unique_ptr<Car>> _spareCars;
+	uint64_t _tick = 0;
+
+	Scheduler* _scheduler = nullptr;
+	std::vector<int> _timers;
+
+	Statistics _statistics;
+	std::ofstream _statisticsFile;
+
+	MetricsSharedMemory _metrics;
+	std::chrono::steady_clock::time_point _rateWindowStart;
+	uint64_t _rateWindowTick = 0;
+	double _ticksPerSecond = 0.0;
 
-	std::future<void> _simulationCycle;
-	std::future<void> _monitorCycle;
+	EventLog _events;
 
 	Renderer _renderer;
 
-	void runSimulationThread();
-	void runMonitorThread();
+	void monitor();
+	void moveCars();
+	// Moves the run of cars of class C starting at cars[first] of the lane and returns the index after it.
+	template <VehicleClass C>
+	size_t moveRun(Lane* lane, size_t first);
+	void logSignalChanges();
+	void dispatchTrips();
 	void render();
+	// Keeps the renderer's heatmap current from here on; runs that never render do not pay for it.
+	void trackOccupancy(bool isTracking);
+	void publishMetrics();
+	void buildLaneGeometry(const Scenario& scenario);
 	const std::string& convertSignalToScreen(Intersection::Colors color) const;
 public:
-	Simulation();
-	void start();
+	// The built-in four-street cross (Scenario::createCross()).
+	explicit Simulation(Lane::Model laneModel = Lane::Microscopic);
+	// Mesoscopic forces every lane to the mesoscopic model; otherwise each lane uses the model the scenario gives it.
+	explicit Simulation(const Scenario& scenario, Lane::Model laneModel = Lane::Microscopic);
+	~Simulation();
+	void start(Scheduler& scheduler);
 	void stop();
+	void tick();
 	void notify(const std::string& message, const std::any& data) override;
+	// Replaces the origins' random demand with trips read from the stream as the run reaches them.
+	void setDemand(std::unique_ptr<DemandStream> demand);
+	const Statistics& getStatistics() const { return _statistics; }
+	int getLaneCount() const { return static_cast<int>(_lanes.size()); }
+	int getCarCount() const { return static_cast<int>(_cars.size()); }
+	uint64_t getTick() const { return _tick; }
+	const Lane& getLane(int id) const { return *_lanes.at(id); }
+	const std::vector<std::unique_ptr<Car>>& getCars() const { return _cars; }
+	// The signal the lane waits at, or nullptr if it does not end at an intersection.
+	const Intersection* getLaneSignal(int id) const { return _laneSignals.at(id); }
+	// Most cars the network can hold at once: one per lane cell or queue slot, one per movement through an intersection
+	// box, and one per lane waiting to be removed at a terminal.
+	int getCarCapacity() const;
+	// Allocates cars up front so that no tick allocates one, however full the network gets.
+	void reserveCars(int count);
+	Router& getRouter() { return _router; }
+	Renderer& getRenderer() { return _renderer; }
 };
\ No newline at end of file
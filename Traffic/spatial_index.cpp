@@ -0,0 +1,193 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+void SpatialIndex::findBuckets(const Box& box, int& firstColumn, int& firstRow, int& lastColumn, int& lastRow) const {
+	auto bucket = [this](double offset, int count) {
+		return std::clamp(static_cast<int>(std::floor(offset / _bucketSize)), 0, count - 1);
+	};
+	firstColumn = bucket(box.left - _bounds.left, _columns);
+	lastColumn = bucket(box.right - _bounds.left, _columns);
+	firstRow = bucket(box.top - _bounds.top, _rows);
+	lastRow = bucket(box.bottom - _bounds.top, _rows);
+}
+
+void SpatialIndex::build(const std::vector<Box>& boxes, double bucketSize) {
+	if (!(bucketSize > 0)) {
+		throw std::invalid_argument("Spatial index buckets must have a positive size");
+	}
+
+	_bucketSize = bucketSize;
+	_bounds = boxes.empty() ? Box { 0, 0, 0, 0 } : boxes.front();
+	for (const Box& box : boxes) {
+		_bounds.left = std::min(_bounds.left, box.left);
+		_bounds.top = std::min(_bounds.top, box.top);
+		_bounds.right = std::max(_bounds.right, box.right);
+		_bounds.bottom = std::max(_bounds.bottom, box.bottom);
+	}
+	_columns = static_cast<int>((_bounds.right - _bounds.left) / _bucketSize) + 1;
+	_rows = static_cast<int>((_bounds.bottom - _bounds.top) / _bucketSize) + 1;
+
+	// Count the items per bucket, turn the counts into start offsets, then fill each bucket's range.
+	_bucketStart.assign(static_cast<size_t>(_columns) * _rows + 1, 0);
+	for (const Box& box : boxes) {
+		int firstColumn, firstRow, lastColumn, lastRow;
+		findBuckets(box, firstColumn, firstRow, lastColumn, lastRow);
+		for (int row = firstRow; row <= lastRow; row++) {
+			for (int column = firstColumn; column <= lastColumn; column++) {
+				_bucketStart[static_cast<size_t>(row) * _columns + column + 1]++;
+			}
+		}
+	}
+	for (size_t i = 1; i < _bucketStart.size(); i++) {
+		_bucketStart[i] += _bucketStart[i - 1];
+	}
+
+	_items.resize(_bucketStart.back());
+	std::vector<uint32_t> next(_bucketStart.begin(), _bucketStart.end() - 1);
+	for (int item = 0; item < static_cast<int>(boxes.size()); item++) {
+		int firstColumn, firstRow, lastColumn, lastRow;
+		findBuckets(boxes[item], firstColumn, firstRow, lastColumn, lastRow);
+		for (int row = firstRow; row <= lastRow; row++) {
+			for (int column = firstColumn; column <= lastColumn; column++) {
+				_items[next[static_cast<size_t>(row) * _columns + column]++] = item;
+			}
+		}
+	}
+
+	_boxes = boxes;
+	_lastQuery.assign(boxes.size(), 0);
+	_query = 0;
+	_levels.clear();
+	_shareStart.clear();
+	_shares.clear();
+}
+
+void SpatialIndex::setSegments(const std::vector<Segment>& segments, const std::vector<double>& capacities) {
+	if (segments.size() != _boxes.size() || capacities.size() != _boxes.size()) {
+		throw std::invalid_argument("The heatmap needs one segment and one capacity per item");
+	}
+
+	_heatSize = _bucketSize / HEAT_DIVISIONS;
+	_levels.clear();
+	int columns = _columns * HEAT_DIVISIONS;
+	int rows = _rows * HEAT_DIVISIONS;
+	while (true) {
+		size_t cells = static_cast<size_t>(columns) * rows;
+		_levels.push_back({ columns, rows, std::vector<double>(cells, 0.0), std::vector<double>(cells, 0.0) });
+		if (columns == 1 && rows == 1) {
+			break;
+		}
+		columns = (columns + 1) / 2;
+		rows = (rows + 1) / 2;
+	}
+
+	// Samples every half heat cell along the segment; those in one cell are consecutive, as a straight segment passes
+	// through each cell in one stretch.
+	const Level& cells = _levels.front();
+	_shareStart.assign(1, 0);
+	_shares.clear();
+	for (size_t item = 0; item < segments.size(); item++) {
+		const Segment& segment = segments[item];
+		double length = std::hypot(segment.x2 - segment.x1, segment.y2 - segment.y1);
+		int samples = std::max(1, static_cast<int>(std::ceil(2 * length / _heatSize)));
+		size_t first = _shares.size();
+		for (int sample = 0; sample < samples; sample++) {
+			double t = (sample + 0.5) / samples;
+			int column = std::clamp(static_cast<int>(std::floor((segment.x1 + (segment.x2 - segment.x1) * t - _bounds.left) / _heatSize)), 0, cells.columns - 1);
+			int row = std::clamp(static_cast<int>(std::floor((segment.y1 + (segment.y2 - segment.y1) * t - _bounds.top) / _heatSize)), 0, cells.rows - 1);
+			if (_shares.size() > first && _shares.back().column == column && _shares.back().row == row) {
+				_shares.back().weight += 1.0 / samples;
+			}
+			else {
+				_shares.push_back({ column, row, 1.0 / samples });
+			}
+		}
+		_shareStart.push_back(static_cast<uint32_t>(_shares.size()));
+		spread(static_cast<int>(item), capacities[item], &Level::capacity);
+	}
+}
+
+void SpatialIndex::spread(int item, double amount, std::vector<double> Level::* values) {
+	if (_levels.empty()) {
+		return;
+	}
+	for (uint32_t i = _shareStart[item]; i < _shareStart[item + 1]; i++) {
+		const Share& share = _shares[i];
+		for (size_t level = 0; level < _levels.size(); level++) {
+			Level& cells = _levels[level];
+			(cells.*values)[static_cast<size_t>(share.row >> level) * cells.columns + (share.column >> level)] += amount * share.weight;
+		}
+	}
+}
+
+void SpatialIndex::clearLoads() {
+	for (Level& level : _levels) {
+		std::fill(level.load.begin(), level.load.end(), 0.0);
+	}
+}
+
+void SpatialIndex::sumLoad(const Box& area, double& load, double& capacity) const {
+	load = 0.0;
+	capacity = 0.0;
+	if (_levels.empty() || area.right < _bounds.left || area.left > _bounds.right || area.bottom < _bounds.top || area.top > _bounds.bottom) {
+		return;
+	}
+
+	// Cells at least as large as the area, so at most 2x2 of them lie under it.
+	size_t level = 0;
+	double size = _heatSize;
+	while (level + 1 < _levels.size() && size < std::max(area.right - area.left, area.bottom - area.top)) {
+		level++;
+		size *= 2;
+	}
+
+	const Level& cells = _levels[level];
+	auto cell = [size](double offset, int count) {
+		return std::clamp(static_cast<int>(std::floor(offset / size)), 0, count - 1);
+	};
+	int lastRow = cell(area.bottom - _bounds.top, cells.rows);
+	int lastColumn = cell(area.right - _bounds.left, cells.columns);
+	for (int row = cell(area.top - _bounds.top, cells.rows); row <= lastRow; row++) {
+		for (int column = cell(area.left - _bounds.left, cells.columns); column <= lastColumn; column++) {
+			size_t index = static_cast<size_t>(row) * cells.columns + column;
+			load += cells.load[index];
+			capacity += cells.capacity[index];
+		}
+	}
+}
+
+void SpatialIndex::query(const Box& area, std::vector<int>& found) {
+	if (_lastQuery.empty() || area.right < _bounds.left || area.left > _bounds.right || area.bottom < _bounds.top || area.top > _bounds.bottom) {
+		return;
+	}
+
+	if (++_query == 0) {
+		std::fill(_lastQuery.begin(), _lastQuery.end(), 0);
+		_query = 1;
+	}
+
+	int firstColumn, firstRow, lastColumn, lastRow;
+	findBuckets(area, firstColumn, firstRow, lastColumn, lastRow);
+	for (int row = firstRow; row <= lastRow; row++) {
+		for (int column = firstColumn; column <= lastColumn; column++) {
+			size_t bucket = static_cast<size_t>(row) * _columns + column;
+			for (uint32_t i = _bucketStart[bucket]; i < _bucketStart[bucket + 1]; i++) {
+				int item = _items[i];
+				if (_lastQuery[item] == _query) {
+					continue;
+				}
+				_lastQuery[item] = _query;
+
+				const Box& box = _boxes[item];
+				if (box.right >= area.left && box.left <= area.right && box.bottom >= area.top && box.top <= area.bottom) {
+					found.push_back(item);
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
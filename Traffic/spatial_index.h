@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Uniform grid over the plane for finding the items in a rectangle. Each bucket lists the items whose bounding box
+// overlaps it, stored back to back in one array, so a query visits only the buckets under the rectangle and its cost
+// follows the number of items there rather than the number in the whole index.
+//
+// The index can also keep a heatmap: each item is given a segment and a capacity, spread over the heat cells (a finer
+// grid) along the segment in proportion to its length in each, and load added to the item is spread the same way.
+// Every level of a pyramid above the heat cells sums 2x2 cells of the level below, so the load and capacity of an area
+// of any size are read from at most a few cells, and adding load costs one update per level of each cell it touches.
+class SpatialIndex {
+public:
+	struct Box {
+		double left;
+		double top;
+		double right;
+		double bottom;
+	};
+
+	struct Segment {
+		double x1;
+		double y1;
+		double x2;
+		double y2;
+	};
+
+	// Heat cells per bucket side.
+	static constexpr int HEAT_DIVISIONS = 4;
+private:
+	struct Share {
+		int column;
+		int row;
+		double weight;
+	};
+
+	struct Level {
+		int columns;
+		int rows;
+		std::vector<double> load;
+		std::vector<double> capacity;
+	};
+
+	Box _bounds { 0, 0, 0, 0 };
+	double _bucketSize = 1.0;
+	int _columns = 0;
+	int _rows = 0;
+	// Items in bucket b are _items[_bucketStart[b]] up to _items[_bucketStart[b + 1]].
+	std::vector<uint32_t> _bucketStart;
+	std::vector<int> _items;
+	std::vector<Box> _boxes;
+	// Query number that last looked at each item, so an item spanning several buckets is checked and reported once.
+	std::vector<uint32_t> _lastQuery;
+	uint32_t _query = 0;
+
+	// Item i's heat cells are _shares[_shareStart[i]] up to _shares[_shareStart[i + 1]]. _levels[0] is the heat cells.
+	std::vector<uint32_t> _shareStart;
+	std::vector<Share> _shares;
+	std::vector<Level> _levels;
+	double _heatSize = 1.0;
+
+	void findBuckets(const Box& box, int& firstColumn, int& firstRow, int& lastColumn, int& lastRow) const;
+	void spread(int item, double amount, std::vector<double> Level::* values);
+public:
+	// Item i is boxes[i]. Buckets are bucketSize on a side.
+	void build(const std::vector<Box>& boxes, double bucketSize);
+	// Appends every item whose box overlaps `area` to `found`, once each.
+	void query(const Box& area, std::vector<int>& found);
+	// Gives item i segments[i] and capacities[i] in the heatmap, and clears its load. Call after build(). Throws
+	// std::invalid_argument unless there is one of each per item.
+	void setSegments(const std::vector<Segment>& segments, const std::vector<double>& capacities);
+	void addLoad(int item, double amount) { spread(item, amount, &Level::load); }
+	void clearLoads();
+	// Load and capacity of the heat cells under `area`, read from the coarsest level whose cells are no smaller than it.
+	void sumLoad(const Box& area, double& load, double& capacity) const;
+	// Smallest box around every item.
+	const Box& getBounds() const { return _bounds; }
+	int getItemCount() const { return static_cast<int>(_boxes.size()); }
+};
\ No newline at end of file
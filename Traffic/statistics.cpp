@@ -0,0 +1,219 @@
+#include "statistics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+int Histogram::bucketIndex(uint32_t value) {
+	if (value < SUB_BUCKETS) {
+		return static_cast<int>(value);
+	}
+
+	int magnitude = std::bit_width(value) - SUB_BUCKET_BITS;
+	int subBucket = static_cast<int>(value >> magnitude);
+	return SUB_BUCKETS + (magnitude - 1) * HALF_SUB_BUCKETS + (subBucket - HALF_SUB_BUCKETS);
+}
+
+uint32_t Histogram::bucketUpperBound(int index) {
+	if (index < SUB_BUCKETS) {
+		return static_cast<uint32_t>(index);
+	}
+
+	int offset = index - SUB_BUCKETS;
+	int magnitude = offset / HALF_SUB_BUCKETS + 1;
+	uint64_t subBucket = offset % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+	return static_cast<uint32_t>(((subBucket + 1) << magnitude) - 1);
+}
+
+void Histogram::record(uint32_t value) {
+	_counts[bucketIndex(value)]++;
+	_total++;
+	_sum += value;
+	_min = std::min(_min, value);
+	_max = std::max(_max, value);
+}
+
+void Histogram::reset() {
+	_counts.fill(0);
+	_total = 0;
+	_sum = 0;
+	_min = UINT32_MAX;
+	_max = 0;
+}
+
+uint32_t Histogram::getPercentile(double percentile) const {
+	if (_total == 0) {
+		return 0;
+	}
+
+	uint64_t target = static_cast<uint64_t>(percentile / 100.0 * _total + 0.5);
+	target = std::clamp<uint64_t>(target, 1, _total);
+
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKET_COUNT; i++) {
+		seen += _counts[i];
+		if (seen >= target) {
+			return std::min(bucketUpperBound(i), _max);
+		}
+	}
+
+	return _max;
+}
+
+Statistics::Statistics(int laneCount, uint64_t bucketTicks) : _bucketTicks(bucketTicks) {
+	if (bucketTicks == 0) {
+		throw std::invalid_argument("Statistics bucket length must be at least one tick");
+	}
+	resize(laneCount);
+}
+
+void Statistics::resize(int laneCount) {
+	_laneBucket.assign(laneCount, LaneCounters());
+	_laneThroughputTotal.assign(laneCount, 0);
+	_laneQueueLength.assign(laneCount, Histogram());
+}
+
+void Statistics::setExport(std::ostream* out, Format format) {
+	_export = out;
+	_format = format;
+
+	if (_export != nullptr && _format == Csv) {
+		*_export << "bucket_start,scope,id,throughput,queue_mean,queue_max,trips,stops,travel_p50,travel_p95,travel_max\n";
+	}
+}
+
+void Statistics::recordLaneExit(int laneId) {
+	if (laneId < 0 || laneId >= static_cast<int>(_laneBucket.size())) {
+		return;
+	}
+
+	_laneBucket[laneId].throughput++;
+	_laneThroughputTotal[laneId]++;
+	_current.throughput++;
+}
+
+void Statistics::recordQueuedCar(int laneId) {
+	if (laneId < 0 || laneId >= static_cast<int>(_laneBucket.size())) {
+		return;
+	}
+
+	_laneBucket[laneId].queueNow++;
+}
+
+void Statistics::recordQueuedCars(int laneId, int count) {
+	if (laneId < 0 || laneId >= static_cast<int>(_laneBucket.size())) {
+		return;
+	}
+
+	_laneBucket[laneId].queueNow += count;
+}
+
+void Statistics::recordStop() {
+	_current.stops++;
+}
+
+void Statistics::recordTrip(uint32_t travelTicks, uint32_t stops) {
+	_current.completedTrips++;
+	_bucketTravelTime.record(travelTicks);
+	_travelTime.record(travelTicks);
+	_stopsPerTrip.record(stops);
+}
+
+void Statistics::endTick(uint64_t tick) {
+	for (size_t i = 0; i < _laneBucket.size(); i++) {
+		LaneCounters& lane = _laneBucket[i];
+		_laneQueueLength[i].record(lane.queueNow);
+		lane.queueSum += lane.queueNow;
+		lane.queueMax = std::max(lane.queueMax, lane.queueNow);
+		lane.queueNow = 0;
+	}
+
+	_ticksInBucket++;
+	if (_ticksInBucket >= _bucketTicks) {
+		closeBucket();
+		_bucketStart = tick + 1;
+	}
+}
+
+void Statistics::flush() {
+	if (_ticksInBucket > 0) {
+		closeBucket();
+		_bucketStart += _bucketTicks;
+	}
+
+	if (_export != nullptr) {
+		_export->flush();
+	}
+}
+
+void Statistics::closeBucket() {
+	_current.startTick = _bucketStart;
+	_current.travelTimeP50 = _bucketTravelTime.getPercentile(50.0);
+	_current.travelTimeP95 = _bucketTravelTime.getPercentile(95.0);
+	_current.travelTimeMax = _bucketTravelTime.getMax();
+
+	if (_export != nullptr) {
+		if (_format == Csv) {
+			writeCsv(_current);
+		}
+		else {
+			writeJson(_current);
+		}
+	}
+
+	_recent[_recentNext] = _current;
+	_recentNext = (_recentNext + 1) % RECENT_BUCKETS;
+	_recentCount = std::min(_recentCount + 1, RECENT_BUCKETS);
+
+	_current = NetworkSummary();
+	_bucketTravelTime.reset();
+	std::fill(_laneBucket.begin(), _laneBucket.end(), LaneCounters());
+	_ticksInBucket = 0;
+}
+
+void Statistics::writeCsv(const NetworkSummary& summary) {
+	std::ostream& out = *_export;
+	out << summary.startTick << ",network,," << summary.throughput << ",,," << summary.completedTrips << ","
+		<< summary.stops << "," << summary.travelTimeP50 << "," << summary.travelTimeP95 << "," << summary.travelTimeMax << "\n";
+
+	for (size_t i = 0; i < _laneBucket.size(); i++) {
+		const LaneCounters& lane = _laneBucket[i];
+		out << summary.startTick << ",lane," << i << "," << lane.throughput << ","
+			<< static_cast<double>(lane.queueSum) / _ticksInBucket << "," << lane.queueMax << ",,,,,\n";
+	}
+}
+
+void Statistics::writeJson(const NetworkSummary& summary) {
+	// One object per line, so the file can be streamed and appended to indefinitely.
+	std::ostream& out = *_export;
+	out << "{\"bucket_start\":" << summary.startTick
+		<< ",\"throughput\":" << summary.throughput
+		<< ",\"trips\":" << summary.completedTrips
+		<< ",\"stops\":" << summary.stops
+		<< ",\"travel_p50\":" << summary.travelTimeP50
+		<< ",\"travel_p95\":" << summary.travelTimeP95
+		<< ",\"travel_max\":" << summary.travelTimeMax
+		<< ",\"lanes\":[";
+
+	for (size_t i = 0; i < _laneBucket.size(); i++) {
+		const LaneCounters& lane = _laneBucket[i];
+		out << (i == 0 ? "" : ",")
+			<< "{\"id\":" << i
+			<< ",\"throughput\":" << lane.throughput
+			<< ",\"queue_mean\":" << static_cast<double>(lane.queueSum) / _ticksInBucket
+			<< ",\"queue_max\":" << lane.queueMax << "}";
+	}
+
+	out << "]}\n";
+}
+
+const Statistics::NetworkSummary& Statistics::getRecent(int age) const {
+	if (age < 0 || age >= _recentCount) {
+		throw std::out_of_range("No statistics bucket of that age");
+	}
+
+	return _recent[(_recentNext - 1 - age + RECENT_BUCKETS) % RECENT_BUCKETS];
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Log-linear histogram in the style of HdrHistogram. Values below SUB_BUCKETS are recorded exactly; above that,
+// each power of two is split into HALF_SUB_BUCKETS buckets, so a percentile, reported as the upper end of its bucket,
+// is less than 1 / HALF_SUB_BUCKETS above the value recorded for any 32-bit value. Storage is a fixed array
+// regardless of how many values are recorded.
+class Histogram {
+public:
+	static constexpr int SUB_BUCKET_BITS = 4;
+	static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static constexpr int HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+	static constexpr int BUCKET_COUNT = SUB_BUCKETS + (32 - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS;
+private:
+	std::array<uint64_t, BUCKET_COUNT> _counts{};
+	uint64_t _total = 0;
+	uint64_t _sum = 0;
+	uint32_t _min = UINT32_MAX;
+	uint32_t _max = 0;
+
+	static int bucketIndex(uint32_t value);
+	static uint32_t bucketUpperBound(int index);
+public:
+	void record(uint32_t value);
+	void reset();
+	uint64_t getCount() const { return _total; }
+	uint32_t getMin() const { return _total == 0 ? 0 : _min; }
+	uint32_t getMax() const { return _max; }
+	double getMean() const { return _total == 0 ? 0.0 : static_cast<double>(_sum) / _total; }
+	uint32_t getPercentile(double percentile) const;
+};
+
+// Incremental traffic statistics. Every recording call is O(1) and touches only preallocated storage; lanes are
+// identified by Lane::getId(). Counters accumulate into the current time bucket, and each time a bucket closes it
+// is written to the export stream (if any) and folded into a fixed-size ring of recent network summaries, so
+// memory stays flat no matter how long the run is or how many cars pass through.
+class Statistics {
+public:
+	enum Format { Csv, Json };
+
+	struct NetworkSummary {
+		uint64_t startTick = 0;
+		uint64_t throughput = 0;
+		uint64_t completedTrips = 0;
+		uint64_t stops = 0;
+		uint32_t travelTimeP50 = 0;
+		uint32_t travelTimeP95 = 0;
+		uint32_t travelTimeMax = 0;
+	};
+
+	static constexpr int RECENT_BUCKETS = 60;
+private:
+	struct LaneCounters {
+		uint64_t throughput = 0;
+		uint64_t queueSum = 0;
+		uint32_t queueMax = 0;
+		uint32_t queueNow = 0;
+	};
+
+	uint64_t _bucketTicks;
+	uint64_t _bucketStart = 0;
+	uint64_t _ticksInBucket = 0;
+
+	std::vector<LaneCounters> _laneBucket;
+	std::vector<uint64_t> _laneThroughputTotal;
+	std::vector<Histogram> _laneQueueLength;
+
+	NetworkSummary _current;
+	Histogram _bucketTravelTime;
+	Histogram _travelTime;
+	Histogram _stopsPerTrip;
+
+	std::array<NetworkSummary, RECENT_BUCKETS> _recent{};
+	int _recentCount = 0;
+	int _recentNext = 0;
+
+	std::ostream* _export = nullptr;
+	Format _format = Csv;
+
+	void closeBucket();
+	void writeCsv(const NetworkSummary& summary);
+	void writeJson(const NetworkSummary& summary);
+public:
+	explicit Statistics(int laneCount = 0, uint64_t bucketTicks = 240);
+
+	void resize(int laneCount);
+	void setExport(std::ostream* out, Format format);
+
+	void recordLaneExit(int laneId);
+	void recordQueuedCar(int laneId);
+	void recordQueuedCars(int laneId, int count);
+	void recordStop();
+	void recordTrip(uint32_t travelTicks, uint32_t stops);
+	void endTick(uint64_t tick);
+	void flush();
+
+	uint64_t getLaneThroughput(int laneId) const { return _laneThroughputTotal.at(laneId); }
+	const Histogram& getLaneQueueLength(int laneId) const { return _laneQueueLength.at(laneId); }
+	const Histogram& getTravelTime() const { return _travelTime; }
+	const Histogram& getStopsPerTrip() const { return _stopsPerTrip; }
+	int getRecentCount() const { return _recentCount; }
+	// 0 is the most recently closed bucket.
+	const NetworkSummary& getRecent(int age) const;
+};
\ No newline at end of file
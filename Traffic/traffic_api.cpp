@@ -0,0 +1,164 @@
+#include "traffic_api.h"
+#include "scenario.h"
+#include "simulation.h"
+#include "traffic_nodes.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <string>
+
+static_assert(Intersection::Red == TRAFFIC_SIGNAL_RED && Intersection::Yellow == TRAFFIC_SIGNAL_YELLOW
+	&& Intersection::Green == TRAFFIC_SIGNAL_GREEN, "Signal values are part of the C API");
+static_assert(PassengerCar == TRAFFIC_VEHICLE_PASSENGER_CAR && Bus == TRAFFIC_VEHICLE_BUS && Truck == TRAFFIC_VEHICLE_TRUCK,
+	"Vehicle class values are part of the C API");
+
+struct TrafficSimulation {
+	Simulation simulation;
+
+	TrafficSimulation(const Scenario& scenario, Lane::Model laneModel) : simulation(scenario, laneModel) {}
+};
+
+namespace {
+	thread_local std::string lastError;
+
+	// No C++ exception may cross the C boundary; each is turned into the error message and a failure value.
+	template <typename Result, typename Call>
+	Result guard(Result failure, Call call) {
+		try {
+			lastError.clear();
+			return call();
+		}
+		catch (const std::exception& e) {
+			lastError = e.what();
+		}
+		catch (...) {
+			lastError = "Unknown error";
+		}
+		return failure;
+	}
+
+	TrafficSimulation* create(const Scenario& scenario, int mesoscopic) {
+		return new TrafficSimulation(scenario, mesoscopic != 0 ? Lane::Mesoscopic : Lane::Microscopic);
+	}
+
+	bool isMissing(const TrafficSimulation* simulation) {
+		if (simulation == nullptr) {
+			lastError = "Simulation is NULL";
+			return true;
+		}
+		return false;
+	}
+}
+
+uint32_t traffic_api_version(void) {
+	return TRAFFIC_API_VERSION;
+}
+
+const char* traffic_last_error(void) {
+	return lastError.c_str();
+}
+
+TrafficSimulation* traffic_create(const char* scenarioText, int mesoscopic) {
+	return guard<TrafficSimulation*>(nullptr, [&]() {
+		if (scenarioText == nullptr) {
+			return create(Scenario::createCross(), mesoscopic);
+		}
+		std::istringstream in(scenarioText);
+		return create(Scenario::read(in), mesoscopic);
+		});
+}
+
+TrafficSimulation* traffic_create_from_file(const char* path, int mesoscopic) {
+	return guard<TrafficSimulation*>(nullptr, [&]() {
+		return create(Scenario::load(path != nullptr ? path : ""), mesoscopic);
+		});
+}
+
+void traffic_destroy(TrafficSimulation* simulation) {
+	delete simulation;
+}
+
+int traffic_step(TrafficSimulation* simulation, uint32_t ticks) {
+	return guard(-1, [&]() {
+		if (isMissing(simulation)) {
+			return -1;
+		}
+		for (uint32_t i = 0; i < ticks; i++) {
+			simulation->simulation.tick();
+		}
+		return 0;
+		});
+}
+
+uint64_t traffic_get_tick(const TrafficSimulation* simulation) {
+	return simulation != nullptr ? simulation->simulation.getTick() : 0;
+}
+
+int32_t traffic_get_lane_count(const TrafficSimulation* simulation) {
+	return simulation != nullptr ? simulation->simulation.getLaneCount() : -1;
+}
+
+int32_t traffic_get_car_count(const TrafficSimulation* simulation) {
+	return simulation != nullptr ? simulation->simulation.getCarCount() : -1;
+}
+
+int32_t traffic_export_cars(const TrafficSimulation* simulation, int32_t* lanes, int32_t* positions, int32_t* speeds,
+	int32_t* destinations, uint8_t* vehicleClasses, int32_t capacity) {
+	if (isMissing(simulation)) {
+		return -1;
+	}
+
+	const std::vector<std::unique_ptr<Car>>& cars = simulation->simulation.getCars();
+	int32_t count = std::min(static_cast<int32_t>(cars.size()), std::max(capacity, 0));
+	for (int32_t i = 0; i < count; i++) {
+		const Car& car = *cars[i];
+		const Lane* lane = car.getLane();
+		if (lanes != nullptr) {
+			lanes[i] = lane != nullptr ? lane->getId() : -1;
+		}
+		if (positions != nullptr) {
+			positions[i] = lane != nullptr ? lane->estimatePosition(&car) : 0;
+		}
+		if (speeds != nullptr) {
+			speeds[i] = car.getSpeed();
+		}
+		if (destinations != nullptr) {
+			destinations[i] = car.getDestination();
+		}
+		if (vehicleClasses != nullptr) {
+			vehicleClasses[i] = car.getVehicleClass();
+		}
+	}
+	return static_cast<int32_t>(cars.size());
+}
+
+int32_t traffic_export_lane_occupancy(const TrafficSimulation* simulation, int32_t* occupancy, int32_t capacity) {
+	if (isMissing(simulation)) {
+		return -1;
+	}
+
+	int32_t laneCount = simulation->simulation.getLaneCount();
+	int32_t count = occupancy != nullptr ? std::min(laneCount, capacity) : 0;
+	for (int32_t i = 0; i < count; i++) {
+		occupancy[i] = simulation->simulation.getLane(i).getCarCount();
+	}
+	return laneCount;
+}
+
+int32_t traffic_export_signals(const TrafficSimulation* simulation, uint8_t* signals, int32_t capacity) {
+	if (isMissing(simulation)) {
+		return -1;
+	}
+
+	int32_t laneCount = simulation->simulation.getLaneCount();
+	int32_t count = signals != nullptr ? std::min(laneCount, capacity) : 0;
+	for (int32_t i = 0; i < count; i++) {
+		const Intersection* intersection = simulation->simulation.getLaneSignal(i);
+		signals[i] = intersection != nullptr ? static_cast<uint8_t>(intersection->getSignal(&simulation->simulation.getLane(i)))
+			: TRAFFIC_SIGNAL_NONE;
+	}
+	return laneCount;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+
+// C interface for driving the simulation from other programs and languages. TrafficEngine.vcxproj builds it, with the
+// rest of the engine, into a DLL; define TRAFFIC_API_DLL before including this header to import it from there.
+//
+// A caller creates a simulation from scenario text, advances it any number of ticks per call, and reads its state back
+// in bulk: each export fills caller-owned arrays, one element per car or lane, straight from the simulation's own
+// structures. Nothing is allocated and no function is called per car, so the cost of crossing the language boundary is
+// paid once per export rather than once per value.
+//
+// Every function that can fail returns a negative value or NULL; traffic_last_error() then describes the failure.
+// Simulations in one process share the notification bus and random source, so calls on different simulations must not
+// run at the same time.
+#if defined(_WIN32) && defined(TRAFFIC_API_EXPORTS)
+#define TRAFFIC_API __declspec(dllexport)
+#elif defined(_WIN32) && defined(TRAFFIC_API_DLL)
+#define TRAFFIC_API __declspec(dllimport)
+#elif defined(__GNUC__)
+#define TRAFFIC_API __attribute__((visibility("default")))
+#else
+#define TRAFFIC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped whenever a signature or the meaning of an exported value changes.
+#define TRAFFIC_API_VERSION 2
+
+// Values written by traffic_export_signals().
+#define TRAFFIC_SIGNAL_RED 0
+#define TRAFFIC_SIGNAL_YELLOW 1
+#define TRAFFIC_SIGNAL_GREEN 2
+#define TRAFFIC_SIGNAL_NONE 255
+
+// Values written by traffic_export_cars() to vehicleClasses.
+#define TRAFFIC_VEHICLE_PASSENGER_CAR 0
+#define TRAFFIC_VEHICLE_BUS 1
+#define TRAFFIC_VEHICLE_TRUCK 2
+
+typedef struct TrafficSimulation TrafficSimulation;
+
+TRAFFIC_API uint32_t traffic_api_version(void);
+// Description of the last failure on the calling thread, or an empty string.
+TRAFFIC_API const char* traffic_last_error(void);
+
+// Builds a simulation from scenario text in the format of scenario.h, or the built-in cross if scenarioText is NULL.
+// A nonzero mesoscopic runs every lane as a mesoscopic queue.
+TRAFFIC_API TrafficSimulation* traffic_create(const char* scenarioText, int mesoscopic);
+TRAFFIC_API TrafficSimulation* traffic_create_from_file(const char* path, int mesoscopic);
+TRAFFIC_API void traffic_destroy(TrafficSimulation* simulation);
+
+// Advances the simulation by the given number of ticks. Returns 0, or -1 if a tick failed.
+TRAFFIC_API int traffic_step(TrafficSimulation* simulation, uint32_t ticks);
+TRAFFIC_API uint64_t traffic_get_tick(const TrafficSimulation* simulation);
+TRAFFIC_API int32_t traffic_get_lane_count(const TrafficSimulation* simulation);
+TRAFFIC_API int32_t traffic_get_car_count(const TrafficSimulation* simulation);
+
+// Bulk exports. Each writes at most `capacity` elements to every non-NULL array and returns the full number of cars or
+// lanes, so a caller whose arrays were too small can grow them and export again.
+
+// Per car: the lane it is on (-1 while crossing an intersection), its position along the lane, its speed, its
+// destination terminal (-1 for none) and its class, one of the TRAFFIC_VEHICLE_ values.
+TRAFFIC_API int32_t traffic_export_cars(const TrafficSimulation* simulation, int32_t* lanes, int32_t* positions,
+	int32_t* speeds, int32_t* destinations, uint8_t* vehicleClasses, int32_t capacity);
+// Per lane id: the number of cars on the lane.
+TRAFFIC_API int32_t traffic_export_lane_occupancy(const TrafficSimulation* simulation, int32_t* occupancy, int32_t capacity);
+// Per lane id: the signal at the lane's end, one of the TRAFFIC_SIGNAL_ values.
+TRAFFIC_API int32_t traffic_export_signals(const TrafficSimulation* simulation, uint8_t* signals, int32_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
\ No newline at end of file
@@ -2,12 +2,14 @@
 #include "notifications.h"
 #include "simulation.h"
 
-#include <chrono>
-#include <future>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <memory>
-#include <mutex>
 #include <random>
-#include <thread>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 void Terminal::processBeforeTick() {
 	for (Car* car : _carBuffer) {
@@ -20,24 +22,58 @@ void Terminal::accept(Lane* fromLane, Car* car) {
 	_carBuffer.push_back(car);
 }
 
-void Origin::processAfterTick() {
-	static std::random_device rd;
-	static std::mt19937 gen(rd());
-	static std::uniform_int_distribution<int> distrib(1, 100);
+namespace {
+	// 1 to 100, from a generator shared by every origin.
+	int rollPercent() {
+		static std::random_device rd;
+		static std::mt19937 gen(rd());
+		static std::uniform_int_distribution<int> distrib(1, 100);
+		return distrib(gen);
+	}
+}
+
+void Origin::setFleetMix(int busPercent, int truckPercent) {
+	if (busPercent < 0 || truckPercent < 0 || busPercent + truckPercent > 100) {
+		throw std::invalid_argument("Bus and truck percentages must be non-negative and add up to at most 100");
+	}
+	_busPercent = busPercent;
+	_truckPercent = truckPercent;
+}
+
+VehicleClass Origin::pickVehicleClass() const {
+	if (_busPercent == 0 && _truckPercent == 0) {
+		return PassengerCar;
+	}
+	int roll = rollPercent();
+	return roll <= _busPercent ? Bus : roll <= _busPercent + _truckPercent ? Truck : PassengerCar;
+}
 
-	int roll = distrib(gen);
+void Origin::processAfterTick() {
+	for (Lane* lane : _lanes) {
+		if (_demandPercent > 0 && rollPercent() <= _demandPercent) {
+			Departure departure { lane, -1, pickVehicleClass() };
+			Notifications::emit(Notifications::CREATE_CAR_MESSAGE, &departure);
+		}
+	}
 
-	if (roll % 5 == 0) {
-		Notifications::emit(Notifications::CREATE_CAR_MESSAGE, _lane);
+	// Dispatched trips take turns across the lanes, at most one per lane per tick.
+	for (size_t tried = 0; tried < _lanes.size() && !_waiting.empty(); tried++) {
+		Lane* lane = _lanes[_nextLane];
+		_nextLane = (_nextLane + 1) % _lanes.size();
+		if (lane->hasRoomAtEntrance()) {
+			Departure departure { lane, _waiting.front(), pickVehicleClass() };
+			Notifications::emit(Notifications::CREATE_CAR_MESSAGE, &departure);
+			_waiting.pop_front();
+		}
 	}
 }
 
-bool Intersection::canEnter(Lane* fromLane) const {
-	bool isRedLight = _stopLights.at(fromLane)->getState() == Red;
+bool Intersection::canEnter(Lane* fromLane, const Car* car) const {
+	bool isRedLight = getSignal(fromLane) == Red;
 
 	if (!isRedLight) {
-		auto search = _carBuffer.find(_connections.at(fromLane));
-		return search == _carBuffer.end() || search->second == nullptr;
+		uint64_t conflicting = _conflicts[findMovement(fromLane, car)];
+		return (_occupied & conflicting) == 0 && std::popcount(_occupied) < _capacity;
 	}
 	else {
 		return false;
@@ -45,97 +81,393 @@ bool Intersection::canEnter(Lane* fromLane) const {
 }
 
 void Intersection::createConnection(Lane* fromLane, Lane* toLane, Intersection::Colors initialSignal) {
-	_connections[fromLane] = toLane;
-	_stopLights[fromLane] = std::make_unique<StopLight>(initialSignal);
+	if (_movements.size() >= MAX_MOVEMENTS) {
+		throw std::length_error("Intersection supports at most 64 movements");
+	}
+
+	int movement = static_cast<int>(_movements.size());
+	_movements.push_back({ toLane, nullptr });
+
+	int slot = fromLane->getEndSlot();
+	if (slot >= 0 && slot < approachCount() && _approaches[slot].from == fromLane) {
+		_approaches[slot].exits.push_back(toLane);
+		_approaches[slot].movements.push_back(movement);
+		buildConflicts();
+		return;
+	}
+	// The signal plan's tables have a column per approach, so a new approach would read past their rows.
+	if (_hasPlan) {
+		throw std::logic_error("Approaches can only be connected before the signal plan is set");
+	}
+
+	fromLane->setEndSlot(approachCount());
+	_approaches.push_back({ fromLane, { toLane }, { movement }, initialSignal });
+	_nextHop.resize(_approaches.size() * _destinationCount, NO_ROUTE);
+	buildConflicts();
+
+	if (!_hasPlan) {
+		buildDefaultPlan();
+	}
+}
+
+const std::vector<Lane*>& Intersection::getExits(Lane* fromLane) const {
+	return _approaches.at(fromLane->getEndSlot()).exits;
+}
+
+int Intersection::findMovement(Lane* fromLane, const Car* car) const {
+	int slot = fromLane->getEndSlot();
+	const Approach& approach = _approaches[slot];
+
+	int destination = car == nullptr ? -1 : car->getDestination();
+	if (destination >= 0 && destination < _destinationCount) {
+		uint8_t hop = _nextHop[static_cast<size_t>(slot) * _destinationCount + destination];
+		if (hop != NO_ROUTE) {
+			return approach.movements[hop];
+		}
+	}
+
+	return approach.movements.front();
+}
+
+Lane* Intersection::route(Lane* fromLane, const Car* car) const {
+	return _movements[findMovement(fromLane, car)].exit;
+}
+
+void Intersection::setDestinationCount(int count) {
+	_destinationCount = count;
+	_nextHop.assign(_approaches.size() * _destinationCount, NO_ROUTE);
+}
+
+void Intersection::setNextHop(Lane* fromLane, int destination, uint8_t exitIndex) {
+	_nextHop[static_cast<size_t>(fromLane->getEndSlot()) * _destinationCount + destination] = exitIndex;
+}
+
+void Intersection::setBoundaryOrder(const std::vector<Lane*>& clockwise) {
+	_boundaryOrder = clockwise;
+	buildConflicts();
+}
+
+bool Intersection::conflicts(Lane* fromA, Lane* toA, Lane* fromB, Lane* toB) const {
+	if (toA == toB) {
+		return true;
+	}
+	if (fromA == fromB) {
+		return false;
+	}
+
+	auto position = [this](Lane* lane) {
+		auto found = std::find(_boundaryOrder.begin(), _boundaryOrder.end(), lane);
+		return found == _boundaryOrder.end() ? -1 : static_cast<int>(found - _boundaryOrder.begin());
+	};
+
+	int a1 = position(fromA);
+	int a2 = position(toA);
+	int b1 = position(fromB);
+	int b2 = position(toB);
+	if (a1 < 0 || a2 < 0 || b1 < 0 || b2 < 0) {
+		return false;
+	}
+
+	// Treat each movement as a chord between two points on the boundary of the box. Two chords with distinct endpoints
+	// cross exactly when one endpoint of the second lies on each side of the first.
+	auto isBetween = [a1, a2](int p) {
+		int low = std::min(a1, a2);
+		int high = std::max(a1, a2);
+		return p > low && p < high;
+	};
+	return isBetween(b1) != isBetween(b2);
+}
+
+void Intersection::buildConflicts() {
+	// Computed once per topology change, so the pairwise work never reaches the tick.
+	std::vector<std::pair<Lane*, Lane*>> paths(_movements.size());
+	for (const Approach& approach : _approaches) {
+		for (size_t i = 0; i < approach.exits.size(); i++) {
+			paths[approach.movements[i]] = { approach.from, approach.exits[i] };
+		}
+	}
+
+	_conflicts.assign(_movements.size(), 0);
+	for (size_t m = 0; m < paths.size(); m++) {
+		for (size_t n = 0; n < paths.size(); n++) {
+			if (m == n || conflicts(paths[m].first, paths[m].second, paths[n].first, paths[n].second)) {
+				_conflicts[m] |= uint64_t(1) << n;
+			}
+		}
+	}
 }
 
 void Intersection::accept(Lane* fromLane, Car* car) {
-	Lane* exit = _connections.at(fromLane);
-	_carBuffer[exit] = car;
+	int movement = findMovement(fromLane, car);
+	_movements[movement].car = car;
+	_occupied |= uint64_t(1) << movement;
 }
 
 void Intersection::processAfterTick() {
-	for (auto pair : _carBuffer) {
-		Car* car = pair.second;
-		if (car != nullptr) {
-			Lane* nextLane = pair.first;
+	uint64_t pending = _occupied;
+	while (pending != 0) {
+		int movement = std::countr_zero(pending);
+		pending &= pending - 1;
 
-			if (nextLane->findCarAt(0) != nullptr) {
-				continue;
-			}
+		Car* car = _movements[movement].car;
+		Lane* nextLane = _movements[movement].exit;
 
-			nextLane->addCar(car);
-			car->setLane(nextLane);
-			car->resetPosition();
-			
-			_carBuffer[nextLane] = nullptr;
+		if (!nextLane->hasRoomAtEntrance()) {
+			continue;
 		}
+
+		car->resetPosition();
+		nextLane->addCar(car);
+		car->setLane(nextLane);
+
+		_movements[movement].car = nullptr;
+		_occupied &= ~(uint64_t(1) << movement);
 	}
 }
 
 void Intersection::processBeforeTick() {}
 
-void Intersection::startTrafficSignals() {
-	_areStopLightsRunning = true;
+int SignalPlan::getCycleTicks() const {
+	int cycle = 0;
+	for (const SignalPhase& phase : phases) {
+		cycle += phase.greenTicks + phase.yellowTicks + phase.allRedTicks;
+	}
+	return cycle;
+}
+
+void Intersection::buildDefaultPlan() {
+	// Each approach runs its own Green -> Yellow -> Red sequence, entered at the point given by its initial signal.
+	_cycleTicks = DEFAULT_GREEN_TICKS + DEFAULT_YELLOW_TICKS + DEFAULT_RED_TICKS;
+	_offsetTicks = 0;
+	int approaches = approachCount();
+	_phaseTable.assign(static_cast<size_t>(_cycleTicks) * approaches, Red);
 
-	_cycleFuture = std::async(std::launch::async, [this]() {
-		const int PULSE_INTERVAL_MS = 1000;
-		while (_areStopLightsRunning) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(PULSE_INTERVAL_MS));
+	for (int slot = 0; slot < approaches; slot++) {
+		int shift = 0;
+		switch (_approaches[slot].initialSignal) {
+		case Green:
+			shift = 0;
+			break;
+		case Yellow:
+			shift = DEFAULT_GREEN_TICKS;
+			break;
+		case Red:
+			shift = DEFAULT_GREEN_TICKS + DEFAULT_YELLOW_TICKS;
+			break;
+		}
 
-			std::lock_guard<std::mutex> hold(_stopLightMutex);
-			for (auto& pair : _stopLights) {
-				StopLight* stoplight = pair.second.get();
-				stoplight->processTick();
+		for (int t = 0; t < _cycleTicks; t++) {
+			int sequence = (t + shift) % _cycleTicks;
+			Colors color = Red;
+			if (sequence < DEFAULT_GREEN_TICKS) {
+				color = Green;
 			}
+			else if (sequence < DEFAULT_GREEN_TICKS + DEFAULT_YELLOW_TICKS) {
+				color = Yellow;
+			}
+			_phaseTable[static_cast<size_t>(t) * approaches + slot] = color;
 		}
-		});
+	}
+
+	buildPhaseRuns();
+	setTick(_tick);
 }
 
-void Intersection::stopTrafficSignals() {
-	_areStopLightsRunning = false;
+void Intersection::setSignalPlan(const SignalPlan& plan) {
+	int cycle = plan.getCycleTicks();
+	if (cycle <= 0) {
+		throw std::invalid_argument("Signal plan must have a positive cycle length");
+	}
+
+	if (plan.control != SignalPlan::FixedTime && plan.controlTicks <= 0) {
+		throw std::invalid_argument("Actuated signal plan must have a positive gap or headway");
+	}
+
+	_hasPlan = true;
+	_cycleTicks = cycle;
+	_offsetTicks = ((plan.offsetTicks % cycle) + cycle) % cycle;
+	int approaches = approachCount();
+	_phaseTable.assign(static_cast<size_t>(_cycleTicks) * approaches, Red);
+
+	_control = plan.control;
+	_controlTicks = plan.controlTicks;
+	_phaseTimings.clear();
+	_phaseLanes.clear();
+	_colorSince.assign(approaches, 0);
+
+	int phaseStart = 0;
+	for (const SignalPhase& phase : plan.phases) {
+		int greenEnd = phaseStart + phase.greenTicks;
+		int firstLane = static_cast<int>(_phaseLanes.size());
+		_phaseLanes.insert(_phaseLanes.end(), phase.approaches.begin(), phase.approaches.end());
+		_phaseTimings.push_back({ firstLane, static_cast<int>(_phaseLanes.size()), phaseStart, greenEnd,
+			greenEnd + phase.yellowTicks, greenEnd + phase.yellowTicks + phase.allRedTicks,
+			std::max(phase.maxGreenTicks, phase.greenTicks) });
+
+		for (Lane* approach : phase.approaches) {
+			int slot = approach->getEndSlot();
+			if (slot < 0 || slot >= approaches || _approaches[slot].from != approach) {
+				throw std::invalid_argument("Signal plan refers to a lane that does not approach this intersection");
+			}
+
+			for (int t = 0; t < phase.greenTicks + phase.yellowTicks; t++) {
+				Colors color = t < phase.greenTicks ? Green : Yellow;
+				_phaseTable[static_cast<size_t>(phaseStart + t) * approaches + slot] = color;
+			}
+		}
+		phaseStart += phase.greenTicks + phase.yellowTicks + phase.allRedTicks;
+	}
+
+	buildPhaseRuns();
+	setTick(_tick);
+}
+
+void Intersection::buildPhaseRuns() {
+	// For each cell of the phase table, how long the approach has shown its current color and how long that color lasts
+	// in total. Only the metrics publisher needs this, but precomputing keeps it off the tick path too.
+	int approaches = approachCount();
+	_phaseElapsed.assign(_phaseTable.size(), 0);
+	_phaseDuration.assign(_phaseTable.size(), 0);
+
+	for (int slot = 0; slot < approaches; slot++) {
+		auto at = [this, approaches, slot](int t) {
+			return static_cast<size_t>(((t % _cycleTicks) + _cycleTicks) % _cycleTicks) * approaches + slot;
+		};
+
+		for (int t = 0; t < _cycleTicks; t++) {
+			Colors color = _phaseTable[at(t)];
+			int elapsed = 0;
+			while (elapsed < _cycleTicks - 1 && _phaseTable[at(t - elapsed - 1)] == color) {
+				elapsed++;
+			}
+			int remaining = 0;
+			while (elapsed + remaining < _cycleTicks - 1 && _phaseTable[at(t + remaining + 1)] == color) {
+				remaining++;
+			}
+			_phaseElapsed[at(t)] = static_cast<uint16_t>(elapsed);
+			_phaseDuration[at(t)] = static_cast<uint16_t>(elapsed + remaining + 1);
+		}
+	}
 }
 
-Intersection::Colors Intersection::getSignal(Lane* lane) const {
-	std::lock_guard<std::mutex> hold(_stopLightMutex);
-	return _stopLights.at(lane)->getState();
+void Intersection::setTick(uint64_t tick) {
+	if (isActuated() && tick == _tick + 1) {
+		_tick = tick;
+		actuate();
+		return;
+	}
+
+	_tick = tick;
+	_cycleIndex = static_cast<int>((tick + _cycleTicks - _offsetTicks) % _cycleTicks);
+	if (!isActuated()) {
+		return;
+	}
+
+	// Start over from the row the offset gives, as a fixed-time plan would show it.
+	int phase = 0;
+	while (phase + 1 < static_cast<int>(_phaseTimings.size()) && _phaseTimings[phase + 1].start <= _cycleIndex) {
+		phase++;
+	}
+	startPhase(phase);
+	_greenShown = std::min(_cycleIndex + 1, _greenEnd) - _phaseTimings[phase].start;
+
+	int approaches = approachCount();
+	for (int slot = 0; slot < approaches; slot++) {
+		_colorSince[slot] = _tick - _phaseElapsed[static_cast<size_t>(_cycleIndex) * approaches + slot];
+	}
 }
 
-Intersection::StopLight::StopLight(Colors initialSignal) : _state(initialSignal) {
-	switch (initialSignal) {
-	case Red:
-		_waitTicks = 5;
-		break;
-	case Green:
-		_waitTicks = 4;
-		break;
-	case Yellow:
-		_waitTicks = 1;
-		break;
+void Intersection::readDetectors(int& occupancy, uint32_t& count) const {
+	occupancy = 0;
+	count = 0;
+	for (int i = _firstLane; i < _endLane; i++) {
+		occupancy += _phaseLanes[i]->getDetectorOccupancy();
+		count += _phaseLanes[i]->getDetectorCount();
 	}
 }
 
-void Intersection::StopLight::processTick() {
-	_waitTicks--;
+void Intersection::startPhase(int phase) {
+	const PhaseTiming& timing = _phaseTimings[phase];
+	_activePhase = phase;
+	_firstLane = timing.firstLane;
+	_endLane = timing.endLane;
+	int occupancy = 0;
+	uint32_t count = 0;
+	readDetectors(occupancy, count);
+
+	_greenEnd = timing.greenEnd;
+	_yellowEnd = timing.yellowEnd;
+	_phaseEnd = timing.end % _cycleTicks;
+	_maxGreenTicks = timing.maxGreenTicks;
+	_greenShown = 0;
+	_greenTarget = std::clamp(occupancy * _controlTicks, timing.greenEnd - timing.start, timing.maxGreenTicks);
+	// Cars detected before the green count only through the queue they left on the detectors.
+	_ticksSinceDetection = occupancy > 0 ? 0 : _controlTicks;
+	_detectedCount = count;
+}
+
+void Intersection::actuate() {
+	int lastGreen = _greenEnd - 1;
 
-	if (_waitTicks == 0) {
-		advance();
+	// A gap-out decision only needs the last gap's worth of detections, so the detectors are read from that many ticks
+	// before the end of the minimum green. What they saw during the last tick is a car on one or a car that reached one.
+	if (_control == SignalPlan::GapOut && _cycleIndex >= lastGreen - _controlTicks && _cycleIndex <= lastGreen) {
+		int occupancy = 0;
+		uint32_t count = 0;
+		readDetectors(occupancy, count);
+		bool isDetected = occupancy > 0 || count != _detectedCount;
+		_detectedCount = count;
+		_ticksSinceDetection = isDetected ? 0 : _ticksSinceDetection + 1;
 	}
+
+	// Past the minimum green the controller may hold the last green row, until the gap or queue says otherwise or the
+	// green reaches its maximum.
+	if (_greenShown > 0 && _cycleIndex == lastGreen && _greenShown < _maxGreenTicks) {
+		bool isExtended = _control == SignalPlan::GapOut ? _ticksSinceDetection < _controlTicks : _greenShown < _greenTarget;
+		if (isExtended) {
+			_greenShown++;
+			return;
+		}
+	}
+
+	int previous = _cycleIndex;
+	_cycleIndex = (_cycleIndex + 1) % _cycleTicks;
+	bool isChange = _cycleIndex == _greenEnd || _cycleIndex == _yellowEnd;
+	if (_cycleIndex == _phaseEnd) {
+		isChange = true;
+		// Phases without any ticks start and end on the same row.
+		int phaseCount = static_cast<int>(_phaseTimings.size());
+		for (int i = 0; i < phaseCount && _phaseTimings[(_activePhase + 1) % phaseCount].start == _cycleIndex; i++) {
+			startPhase((_activePhase + 1) % phaseCount);
+		}
+	}
+	if (_cycleIndex < _greenEnd) {
+		_greenShown++;
+	}
+
+	// Colors only change where a phase's green, yellow or all red begins.
+	if (isChange) {
+		int approaches = approachCount();
+		for (int slot = 0; slot < approaches; slot++) {
+			if (_phaseTable[static_cast<size_t>(previous) * approaches + slot] != _phaseTable[static_cast<size_t>(_cycleIndex) * approaches + slot]) {
+				_colorSince[slot] = _tick;
+			}
+		}
+	}
+}
+
+Intersection::Colors Intersection::getSignal(const Lane* lane) const {
+	return _phaseTable[static_cast<size_t>(_cycleIndex) * approachCount() + lane->getEndSlot()];
 }
 
-void Intersection::StopLight::advance() {
-	switch (_state) {
-	case Red:
-		_state = Green;
-		_waitTicks = 4;
-		break;
-	case Green:
-		_state = Yellow;
-		_waitTicks = 1;
-		break;
-	case Yellow:
-		_state = Red;
-		_waitTicks = 5;
-		break;
+void Intersection::getPhaseProgress(Lane* lane, int& elapsedTicks, int& phaseTicks) const {
+	size_t cell = static_cast<size_t>(_cycleIndex) * approachCount() + lane->getEndSlot();
+	if (isActuated()) {
+		// Extensions are not in the table, so the duration is the planned one or, once exceeded, the time so far.
+		elapsedTicks = static_cast<int>(_tick - _colorSince[lane->getEndSlot()]);
+		phaseTicks = std::max<int>(_phaseDuration[cell], elapsedTicks + 1);
+		return;
 	}
+	elapsedTicks = _phaseElapsed[cell];
+	phaseTicks = _phaseDuration[cell];
 }
\ No newline at end of file
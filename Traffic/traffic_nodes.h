@@ -1,8 +1,10 @@
 #pragma once
-#include <future>
-#include <map>
+#include "vehicle_class.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <memory>
-#include <mutex>
 #include <vector>
 
 class Car;
@@ -10,7 +12,7 @@ class Lane;
 
 class Enterable {
 public:
-	virtual bool canEnter(Lane* fromLane) const = 0;
+	virtual bool canEnter(Lane* fromLane, const Car* car) const = 0;
 	virtual void accept(Lane* fromLane, Car* car) = 0;
 	virtual void processBeforeTick() = 0;
 	virtual ~Enterable() = default;
@@ -24,51 +26,211 @@ public:
 
 class Terminal : public Enterable {
 private:
+	int _id = -1;
 	std::vector<Car*> _carBuffer;
 public:
-	bool canEnter(Lane* fromLane) const override { return true; }
+	// Destination index used by routing tables.
+	int getId() const { return _id; }
+	void setId(int id) { _id = id; }
+	// At most one car arrives per incoming lane per tick, so this many keeps accept() from allocating.
+	void reserve(size_t cars) { _carBuffer.reserve(cars); }
+	bool canEnter(Lane* fromLane, const Car* car) const override { return true; }
 	void accept(Lane* fromLane, Car* car);
 	void processBeforeTick() override;
 };
 
+// One phase of a signal plan: the approaches it serves get green, then yellow, then everything is red for allRedTicks.
+struct SignalPhase {
+	std::vector<Lane*> approaches;
+	int greenTicks = 0;
+	int yellowTicks = 0;
+	int allRedTicks = 0;
+	// Actuated plans only: the longest the green may be extended to. At or below greenTicks the green is fixed.
+	int maxGreenTicks = 0;
+};
+
+// Signal plan for one Intersection. Phases run in order and their durations (the splits) add up to the cycle length.
+// The offset shifts the whole cycle, so a green wave along a corridor is expressed by giving each intersection an offset
+// equal to the free-flow travel time from the first one.
+//
+// An actuated plan treats each phase's greenTicks as its minimum green and extends the green, up to maxGreenTicks, from
+// the detectors on the lanes it serves (see Lane::Detector). GapOut holds the green until no car has been detected for
+// controlTicks in a row (the gap), or the green reaches its maximum (max-out). QueueLength sizes each green as it starts:
+// controlTicks per car then on the detectors, between the minimum and maximum. The offset only places the first cycle.
+struct SignalPlan {
+	enum Control { FixedTime, GapOut, QueueLength };
+
+	int offsetTicks = 0;
+	std::vector<SignalPhase> phases;
+	Control control = FixedTime;
+	int controlTicks = 0;
+	int getCycleTicks() const;
+};
+
 class Intersection : public Enterable, public Exitable {
 public:
-	enum Colors { Red, Yellow, Green };
+	enum Colors : uint8_t { Red, Yellow, Green };
+	static constexpr int MAX_MOVEMENTS = 64;
 private:
-	class StopLight {
-	private:
-		Colors _state;
-		int _waitTicks = 0;
-		bool _isRunning = false;
-	public:
-		StopLight(Colors initialSignal);
-		void processTick();
-		void advance();
-		Colors getState() const { return _state; }
+	// Default timing used until a SignalPlan is set, matching the original one-second stop light pulse at four ticks
+	// per pulse: Green 4 pulses, Yellow 1, Red 5.
+	static constexpr int DEFAULT_GREEN_TICKS = 16;
+	static constexpr int DEFAULT_YELLOW_TICKS = 4;
+	static constexpr int DEFAULT_RED_TICKS = 20;
+
+	struct Approach {
+		Lane* from;
+		std::vector<Lane*> exits;
+		// Movement id for each exit.
+		std::vector<int> movements;
+		Colors initialSignal;
+	};
+
+	// A movement is one approach-to-exit path through the box; at most one car occupies it at a time.
+	struct Movement {
+		Lane* exit;
+		Car* car;
+	};
+
+	// Indexed by approach slot (Lane::getEndSlot()).
+	std::vector<Approach> _approaches;
+	std::vector<Movement> _movements;
+
+	// Bit m of _occupied is set while movement m has a car in the box, and bit n of _conflicts[m] is set if movements m
+	// and n may not be in the box together (a movement always conflicts with itself). Admitting a car is then a signal
+	// check plus an AND against the occupied mask and a popcount against the box capacity.
+	std::vector<uint64_t> _conflicts;
+	uint64_t _occupied = 0;
+	int _capacity = MAX_MOVEMENTS;
+	std::vector<Lane*> _boundaryOrder;
+
+	// Next-hop table filled in by a Router: entry [slot * _destinationCount + destination] is the index of the exit to
+	// take towards that destination. Cars without a destination, or with one that is unreachable, take the first exit.
+	int _destinationCount = 0;
+	std::vector<uint8_t> _nextHop;
+
+	// Fixed-time signal state is a pure function of the tick: row (tick - offset) mod cycle of the phase table holds the
+	// color of every approach. The row is chosen once per tick in setTick(), so getSignal() is a single array read.
+	int _cycleTicks = 1;
+	int _offsetTicks = 0;
+	std::vector<Colors> _phaseTable;
+	std::vector<uint16_t> _phaseElapsed;
+	std::vector<uint16_t> _phaseDuration;
+	uint64_t _tick = 0;
+	int _cycleIndex = 0;
+	bool _hasPlan = false;
+
+	// Actuated plans only. The row of the phase table then advances one per tick, except that it stays on the last row of
+	// a phase's minimum green for as long as the controller extends the green. Detectors are read only when a decision
+	// needs them: as a phase starts, and through the gap before a gap-out decision. The active phase's rows are copied
+	// into the intersection, so the other ticks touch nothing outside it.
+	struct PhaseTiming {
+		// The phase's approaches are _phaseLanes[firstLane, endLane).
+		int firstLane;
+		int endLane;
+		// Rows of the phase table where the phase's green starts, its yellow starts, its all red starts and it ends.
+		int start;
+		int greenEnd;
+		int yellowEnd;
+		int end;
+		int maxGreenTicks;
 	};
 
-	std::map<Lane*, Lane*> _connections;
-	std::map<Lane*, std::unique_ptr<StopLight>> _stopLights;
-	std::map<Lane*, Car*> _carBuffer;
-	std::future<void> _cycleFuture;
-	bool _areStopLightsRunning = false;
-	mutable std::mutex _stopLightMutex;
+	SignalPlan::Control _control = SignalPlan::FixedTime;
+	int _controlTicks = 0;
+	std::vector<PhaseTiming> _phaseTimings;
+	std::vector<const Lane*> _phaseLanes;
+	int _activePhase = 0;
+	int _firstLane = 0;
+	int _endLane = 0;
+	int _greenEnd = 0;
+	int _yellowEnd = 0;
+	int _phaseEnd = 0;
+	int _maxGreenTicks = 0;
+	// Ticks of green shown so far in the active phase, and the length a QueueLength plan chose for it.
+	int _greenShown = 0;
+	int _greenTarget = 0;
+	int _ticksSinceDetection = 0;
+	uint32_t _detectedCount = 0;
+	// Indexed by approach slot: the tick the approach's signal last changed, since the phase table no longer says.
+	std::vector<uint64_t> _colorSince;
+
+	void buildDefaultPlan();
+	void buildPhaseRuns();
+	bool isActuated() const { return _control != SignalPlan::FixedTime; }
+	// Cars on the active phase's detectors, and cars that have reached them.
+	void readDetectors(int& occupancy, uint32_t& count) const;
+	void startPhase(int phase);
+	void actuate();
+	void buildConflicts();
+	int findMovement(Lane* fromLane, const Car* car) const;
+	int approachCount() const { return static_cast<int>(_approaches.size()); }
 public:
-	bool canEnter(Lane* fromLane) const override;
+	static constexpr uint8_t NO_ROUTE = 0xFF;
+
+	bool canEnter(Lane* fromLane, const Car* car) const override;
+	bool canEnter(Lane* fromLane) const { return canEnter(fromLane, nullptr); }
 	void accept(Lane* fromLane, Car* car);
 	void processBeforeTick() override;
 	void processAfterTick() override;
+	// Allows cars on fromLane to continue onto toLane. A lane may connect to several exits; its signal is the one given
+	// for its first connection. Throws std::logic_error if fromLane is a new approach and a signal plan is already set.
 	void createConnection(Lane* fromLane, Lane* toLane, Intersection::Colors initialSignal);
-	void startTrafficSignals();
-	void stopTrafficSignals();
-	Colors getSignal(Lane* lane) const;
+	const std::vector<Lane*>& getExits(Lane* fromLane) const;
+	Lane* route(Lane* fromLane, const Car* car) const;
+	// Lanes in the order their ends meet the intersection box, going clockwise. Two movements conflict when their paths
+	// across the box cross or end in the same lane; without a boundary order only merging movements conflict.
+	void setBoundaryOrder(const std::vector<Lane*>& clockwise);
+	bool conflicts(Lane* fromA, Lane* toA, Lane* fromB, Lane* toB) const;
+	// Most cars allowed in the box at once.
+	void setCapacity(int capacity) { _capacity = capacity; }
+	void setDestinationCount(int count);
+	void setNextHop(Lane* fromLane, int destination, uint8_t exitIndex);
+	void setSignalPlan(const SignalPlan& plan);
+	// Fixed-time signals show the phase table row for the tick. Actuated signals advance a row per consecutive tick and
+	// restart from the offset on any other.
+	void setTick(uint64_t tick);
+	int getCycleTicks() const { return _cycleTicks; }
+	int getMovementCount() const { return static_cast<int>(_movements.size()); }
+	Colors getSignal(const Lane* lane) const;
+	void getPhaseProgress(Lane* lane, int& elapsedTicks, int& phaseTicks) const;
 };
 
 class Origin : public Exitable {
+public:
+	// CREATE_CAR_MESSAGE carries a pointer to one of these, valid for the duration of the call (a pointer fits in
+	// std::any without a heap allocation): the lane to start on, the destination Terminal id, or -1 for a random one,
+	// and the class of vehicle.
+	struct Departure {
+		Lane* lane;
+		int destination;
+		VehicleClass vehicleClass;
+	};
 private:
-	Lane* _lane = nullptr;
+	std::vector<Lane*> _lanes;
+	int _demandPercent = 20;
+	int _busPercent = 0;
+	int _truckPercent = 0;
+	// Destinations of dispatched trips that have not found room on a lane yet, oldest first.
+	std::deque<int> _waiting;
+	size_t _nextLane = 0;
+
+	VehicleClass pickVehicleClass() const;
 public:
-	void setLane(Lane* lane) { _lane = lane; }
-	Lane* getLane() const { return _lane; }
+	void setLane(Lane* lane) { _lanes.assign(1, lane); }
+	// An origin feeding a multi-lane road releases cars onto each of its lanes independently.
+	void addLane(Lane* lane) { _lanes.push_back(lane); }
+	Lane* getLane() const { return _lanes.empty() ? nullptr : _lanes.front(); }
+	const std::vector<Lane*>& getLanes() const { return _lanes; }
+	// Chance, out of 100, that a car is released onto each lane on each tick.
+	int getDemandPercent() const { return _demandPercent; }
+	void setDemandPercent(int percent) { _demandPercent = percent; }
+	// Chances, out of 100, that a departing vehicle is a bus or a truck; the rest are passenger cars.
+	int getBusPercent() const { return _busPercent; }
+	int getTruckPercent() const { return _truckPercent; }
+	void setFleetMix(int busPercent, int truckPercent);
+	// Queues a trip to the given destination; it departs on the next tick a lane has room at its entrance.
+	void dispatch(int destination) { _waiting.push_back(destination); }
+	int getWaitingCount() const { return static_cast<int>(_waiting.size()); }
 	void processAfterTick() override;
 };
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+// Kinds of vehicle sharing the road. Their parameters are compile-time constants, so code specialized for one class
+// (see Simulation::moveRun) folds them into its instructions instead of loading them per car.
+enum VehicleClass : uint8_t { PassengerCar, Bus, Truck };
+constexpr int VEHICLE_CLASS_COUNT = 3;
+
+// Lengths in cells, speeds in cells per tick, and acceleration and deceleration in cells per tick per tick. A vehicle's
+// position is its front cell; it also occupies the length - 1 cells behind it.
+struct VehicleParameters {
+	int acceleration;
+	int deceleration;
+	int maxSpeed;
+	int length;
+};
+
+// Indexed by VehicleClass. Passenger cars reach cruising speed in one tick and stop in one, as every car once did.
+constexpr VehicleParameters VEHICLE_PARAMETERS[VEHICLE_CLASS_COUNT] = {
+	{ 2, 2, 2, 1 },  // PassengerCar
+	{ 1, 1, 2, 3 },  // Bus
+	{ 1, 1, 1, 4 },  // Truck
+};
+
+constexpr int MAX_VEHICLE_SPEED = std::max({ VEHICLE_PARAMETERS[0].maxSpeed, VEHICLE_PARAMETERS[1].maxSpeed, VEHICLE_PARAMETERS[2].maxSpeed });
+constexpr int MAX_VEHICLE_LENGTH = std::max({ VEHICLE_PARAMETERS[0].length, VEHICLE_PARAMETERS[1].length, VEHICLE_PARAMETERS[2].length });
\ No newline at end of file